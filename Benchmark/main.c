@@ -0,0 +1,441 @@
+/* ASH0-tools ashbench "main.c"
+ * Copyright (c) 2024 Garhoogin and NinjaCheetah
+ * This code is licensed under the MIT license. See LICENSE for more information.
+ *
+ * This file implements a benchmark that compresses and decompresses a corpus of files at a range of settings,
+ * checking that each file comes back unchanged.
+ */
+#define _CRT_SECURE_NO_WARNINGS
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CX_HAVE_RUSAGE
+#include <sys/resource.h>
+#endif
+
+#include "ash0.h"
+#include "fileio.h"
+#include "pathlist.h"
+
+// Most optimizing passes run by -c auto, as in ashcomp.
+#define CX_AUTO_PASSES 16
+
+// Level standing for -c auto in the lists of levels, negative levels being the fast ones.
+#define CX_LEVEL_AUTO INT_MIN
+
+#define CX_MAX_SETTINGS 16
+
+#define CX_FORMAT_TABLE 0
+#define CX_FORMAT_CSV   1
+#define CX_FORMAT_JSON  2
+
+// One set of compression settings, and the results of one file or of a whole corpus with them.
+typedef struct CxBenchResult_ {
+	const char *name;
+	int symBits;
+	int distBits;
+	int level;              // number of optimizing passes, negative for the fast levels, or CX_LEVEL_AUTO
+	uint64_t size;
+	uint64_t compressedSize;
+	double compressMs;      // best of the repetitions
+	double decompressMs;
+	long peakKiB;           // peak resident memory while compressing, or -1 if unknown
+	int ok;                 // the output decompressed back to the input
+} CxBenchResult;
+
+typedef struct CxBenchReport_ {
+	FILE *fp;
+	int format;
+	int nRows;              // rows written so far, for separating JSON objects
+} CxBenchReport;
+
+static double GetMilliseconds(void) {
+	struct timespec ts;
+#ifdef CLOCK_MONOTONIC
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+	timespec_get(&ts, TIME_UTC);
+#endif
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// Starts measuring peak memory from the current usage. On Linux the peak can be reset, so each file is measured
+// on its own. Elsewhere the peak is that of the whole run so far.
+static void ResetPeakMemory(void) {
+#ifdef __linux__
+	FILE *fp = fopen("/proc/self/clear_refs", "w");
+	if (fp != NULL) {
+		fputs("5", fp);
+		fclose(fp);
+	}
+#endif
+}
+
+// Peak resident memory in KiB since ResetPeakMemory, or -1 if it can't be measured.
+static long GetPeakMemory(void) {
+#ifdef __linux__
+	FILE *fp = fopen("/proc/self/status", "r");
+	if (fp != NULL) {
+		char line[256];
+		long peak = -1;
+		while (fgets(line, sizeof(line), fp) != NULL) {
+			if (strncmp(line, "VmHWM:", 6) == 0) peak = strtol(line + 6, NULL, 10);
+		}
+		fclose(fp);
+		if (peak >= 0) return peak;
+	}
+#endif
+#ifdef CX_HAVE_RUSAGE
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#ifdef __APPLE__
+		return (long) (usage.ru_maxrss / 1024);
+#else
+		return (long) usage.ru_maxrss;
+#endif
+	}
+#endif
+	return -1;
+}
+
+// Parses a comma separated list of numbers. For compression levels, "auto" is taken as CX_LEVEL_AUTO. Returns the number of
+// values, or 0 if the list is malformed.
+static int ParseList(const char *arg, int *values, int allowAuto) {
+	int nValues = 0;
+	while (*arg != '\0' && nValues < CX_MAX_SETTINGS) {
+		char *end;
+		if (allowAuto && strncmp(arg, "auto", 4) == 0) {
+			values[nValues++] = CX_LEVEL_AUTO;
+			end = (char *) arg + 4;
+		} else {
+			long value = strtol(arg, &end, 10);
+			if (end == arg) return 0;
+			values[nValues++] = (int) value;
+		}
+		if (*end == ',') end++;
+		else if (*end != '\0') return 0;
+		arg = end;
+	}
+	return *arg == '\0' ? nValues : 0;
+}
+
+// ----- report output
+
+static void WriteQuoted(FILE *fp, const char *str, int format) {
+	// CSV doubles up quotes, while JSON escapes them along with backslashes and control characters.
+	fputc('"', fp);
+	for (const char *p = str; *p != '\0'; p++) {
+		unsigned char c = (unsigned char) *p;
+		if (format == CX_FORMAT_CSV) {
+			if (c == '"') fputc('"', fp);
+			fputc(c, fp);
+		} else if (c == '"' || c == '\\') {
+			fprintf(fp, "\\%c", c);
+		} else if (c < 0x20) {
+			fprintf(fp, "\\u%04x", c);
+		} else {
+			fputc(c, fp);
+		}
+	}
+	fputc('"', fp);
+}
+
+static double MegabytesPerSecond(uint64_t size, double ms) {
+	return ms > 0.0 ? (double) size / 1000.0 / ms : 0.0;
+}
+
+static void BeginReport(CxBenchReport *report) {
+	FILE *fp = report->fp;
+	if (report->format == CX_FORMAT_TABLE) {
+		fprintf(fp, "%-28s %10s %2s %2s %4s %10s %6s %9s %8s %9s %8s %9s %s\n", "file", "size", "l", "d", "c",
+			"out", "ratio", "comp ms", "MB/s", "dec ms", "MB/s", "peak KiB", "check");
+	} else if (report->format == CX_FORMAT_CSV) {
+		fputs("file,size,symBits,distBits,level,compressedSize,ratio,compressMs,compressMBps,decompressMs,"
+			"decompressMBps,peakKiB,ok\n", fp);
+	} else {
+		fputs("{\n\t\"results\": [", fp);
+	}
+}
+
+static void WriteResult(CxBenchReport *report, const CxBenchResult *result) {
+	FILE *fp = report->fp;
+	double ratio = result->size ? (double) result->compressedSize / (double) result->size : 0.0;
+	double compressRate = MegabytesPerSecond(result->size, result->compressMs);
+	double decompressRate = MegabytesPerSecond(result->size, result->decompressMs);
+	char level[16];
+	if (result->level == CX_LEVEL_AUTO) strcpy(level, "auto");
+	else sprintf(level, "%d", result->level);
+
+	if (report->format == CX_FORMAT_TABLE) {
+		// Keep the end of long paths, which is the part that tells files apart.
+		const char *name = result->name;
+		size_t nameLength = strlen(name);
+		if (nameLength > 28) name += nameLength - 28;
+		fprintf(fp, "%-28s %10llu %2d %2d %4s %10llu %6.4f %9.2f %8.2f %9.2f %8.2f %9ld %s\n", name,
+			(unsigned long long) result->size, result->symBits, result->distBits, level,
+			(unsigned long long) result->compressedSize, ratio, result->compressMs, compressRate,
+			result->decompressMs, decompressRate, result->peakKiB, result->ok ? "ok" : "FAILED");
+	} else if (report->format == CX_FORMAT_CSV) {
+		WriteQuoted(fp, result->name, CX_FORMAT_CSV);
+		fprintf(fp, ",%llu,%d,%d,%s,%llu,%.6f,%.3f,%.3f,%.3f,%.3f,%ld,%d\n", (unsigned long long) result->size,
+			result->symBits, result->distBits, level, (unsigned long long) result->compressedSize, ratio,
+			result->compressMs, compressRate, result->decompressMs, decompressRate, result->peakKiB, result->ok);
+	} else {
+		fputs(report->nRows ? ",\n\t\t{ \"file\": " : "\n\t\t{ \"file\": ", fp);
+		WriteQuoted(fp, result->name, CX_FORMAT_JSON);
+		fprintf(fp, ", \"size\": %llu, \"symBits\": %d, \"distBits\": %d, \"level\": \"%s\", \"compressedSize\": %llu, "
+			"\"ratio\": %.6f, \"compressMs\": %.3f, \"compressMBps\": %.3f, \"decompressMs\": %.3f, "
+			"\"decompressMBps\": %.3f, \"peakKiB\": %ld, \"ok\": %s }", (unsigned long long) result->size,
+			result->symBits, result->distBits, level, (unsigned long long) result->compressedSize, ratio,
+			result->compressMs, compressRate, result->decompressMs, decompressRate, result->peakKiB,
+			result->ok ? "true" : "false");
+	}
+	report->nRows++;
+}
+
+// The totals come after all the files. In JSON they get an array of their own.
+static void WriteTotals(CxBenchReport *report, const CxBenchResult *totals, int nTotals) {
+	if (report->format == CX_FORMAT_TABLE) {
+		fputc('\n', report->fp);
+	} else if (report->format == CX_FORMAT_JSON) {
+		fputs("\n\t],\n\t\"totals\": [", report->fp);
+		report->nRows = 0;
+	}
+	for (int i = 0; i < nTotals; i++) WriteResult(report, &totals[i]);
+	if (report->format == CX_FORMAT_JSON) fputs("\n\t]\n}\n", report->fp);
+}
+
+// ----- benchmark
+
+// Compresses and decompresses one file with the given settings, timing the best of nReps runs of each.
+static void BenchmarkFile(const char *path, const unsigned char *data, size_t size, const CxAshCompressParams *params,
+	int level, int nReps, CxAshDecompressContext *dctx, CxBenchResult *result) {
+	result->name = path;
+	result->symBits = params->symBits;
+	result->distBits = params->distBits;
+	result->level = level;
+	result->size = size;
+	result->compressedSize = 0;
+	result->compressMs = 0.0;
+	result->decompressMs = 0.0;
+	result->peakKiB = -1;
+	result->ok = 0;
+
+	// A new context for every file, so that its peak memory doesn't carry over from the files before it.
+	ResetPeakMemory();
+	CxAshCompressContext *ctx = CxAshCompressContextCreate();
+	if (ctx == NULL) return;
+	const void *out = NULL;
+	size_t outSize = 0;
+	int error = CX_ASH_OK;
+	for (int rep = 0; rep < nReps && error == CX_ASH_OK; rep++) {
+		double start = GetMilliseconds();
+		error = CxAshCompress(ctx, data, size, params, &out, &outSize);
+		double elapsed = GetMilliseconds() - start;
+		if (rep == 0 || elapsed < result->compressMs) result->compressMs = elapsed;
+	}
+	result->peakKiB = GetPeakMemory();
+	if (error != CX_ASH_OK) {
+		fprintf(stderr, "%s: Compression failure. %s\n", path, CxAshErrorString(error));
+		CxAshCompressContextDestroy(ctx);
+		return;
+	}
+	result->compressedSize = outSize;
+
+	// The output stays valid until the compression context is used again.
+	unsigned char *check = (unsigned char *) malloc(size + CX_ASH_DECOMPRESS_PADDING);
+	if (check == NULL) {
+		CxAshCompressContextDestroy(ctx);
+		return;
+	}
+	for (int rep = 0; rep < nReps && error == CX_ASH_OK; rep++) {
+		double start = GetMilliseconds();
+		error = CxAshDecompress(dctx, out, outSize, check, size + CX_ASH_DECOMPRESS_PADDING, params->symBits,
+			params->distBits);
+		double elapsed = GetMilliseconds() - start;
+		if (rep == 0 || elapsed < result->decompressMs) result->decompressMs = elapsed;
+	}
+	if (error != CX_ASH_OK) fprintf(stderr, "%s: Decompression failure. %s\n", path, CxAshErrorString(error));
+	result->ok = error == CX_ASH_OK && memcmp(check, data, size) == 0;
+
+	free(check);
+	CxAshCompressContextDestroy(ctx);
+}
+
+int main(int argc, char **argv) {
+	// Syntax: ashbench <input...> [option...]
+	if (argc < 2) {
+		puts("Usage: ashbench <input...> [option...]\n");
+		puts("Options:");
+		puts(" -c <list> Compression levels to run, comma separated, as in ashcomp (default: 0,1,2)");
+		puts(" -d <list> Distance tree bits to run (default: 11)");
+		puts(" -l <list> Length tree bits to run   (default:  9)");
+		puts(" -r <n>    Runs of each file, the fastest being reported (default: 3)");
+		puts(" -j <n>    Threads to compress each file on (default: 1)");
+		puts(" -f <fmt>  Report format: table, csv or json (default: table)");
+		puts(" -o <f>    Write the report to a file rather than standard output");
+		puts(" -i <f>    Read input paths from a list file, one per line");
+		puts("");
+		puts("Inputs that are directories are expanded to the files inside them, except .ash files.");
+		puts("Every file is decompressed again and checked against the original.");
+		puts("");
+		return 1;
+	}
+
+	CxPathList inputs;
+	CxPathListInit(&inputs);
+	int levels[CX_MAX_SETTINGS] = { 0, 1, 2 }, nLevels = 3;
+	int distBits[CX_MAX_SETTINGS] = { 11 }, nDistBits = 1;
+	int symBits[CX_MAX_SETTINGS] = { 9 }, nSymBits = 1;
+	int nReps = 3;
+	unsigned int nThreads = 1;
+	const char *outpath = NULL;
+	CxBenchReport report = { 0 };
+	report.format = CX_FORMAT_TABLE;
+	for (int i = 1; i < argc; i++) {
+		int error = 0;        // 2 for an invalid option value
+		const char *option = argv[i];
+		const char *value = (i + 1 < argc) ? argv[i + 1] : "";
+		if (strcmp(argv[i], "-c") == 0) {
+			i++;
+			nLevels = ParseList(value, levels, 1);
+			if (nLevels == 0) error = 2;
+		} else if (strcmp(argv[i], "-d") == 0) {
+			i++;
+			nDistBits = ParseList(value, distBits, 0);
+			if (nDistBits == 0) error = 2;
+		} else if (strcmp(argv[i], "-l") == 0) {
+			i++;
+			nSymBits = ParseList(value, symBits, 0);
+			if (nSymBits == 0) error = 2;
+		} else if (strcmp(argv[i], "-r") == 0) {
+			i++;
+			nReps = atoi(value);
+			if (nReps < 1) nReps = 1;
+		} else if (strcmp(argv[i], "-j") == 0) {
+			i++;
+			nThreads = atoi(value);
+		} else if (strcmp(argv[i], "-f") == 0) {
+			i++;
+			if (strcmp(value, "table") == 0) report.format = CX_FORMAT_TABLE;
+			else if (strcmp(value, "csv") == 0) report.format = CX_FORMAT_CSV;
+			else if (strcmp(value, "json") == 0) report.format = CX_FORMAT_JSON;
+			else error = 2;
+		} else if (strcmp(argv[i], "-o") == 0) {
+			i++;
+			outpath = value;
+		} else if (strcmp(argv[i], "-i") == 0) {
+			i++;
+			error = CxPathListAddListFile(&inputs, value);
+			if (error) fprintf(stderr, "Could not read the list file %s.\n", value);
+		} else {
+			error = CxPathListAddInput(&inputs, argv[i], ".ash", 0);
+			if (error) fprintf(stderr, "Could not read the directory %s.\n", argv[i]);
+		}
+		if (error) {
+			if (error == 2) fprintf(stderr, "Invalid value for %s.\n", option);
+			CxPathListFree(&inputs);
+			return 1;
+		}
+	}
+	if (inputs.nPaths == 0) {
+		fprintf(stderr, "No input files.\n");
+		CxPathListFree(&inputs);
+		return 1;
+	}
+
+	report.fp = stdout;
+	if (outpath != NULL) {
+		report.fp = fopen(outpath, "w");
+		if (report.fp == NULL) {
+			fprintf(stderr, "Could not open %s for write access.\n", outpath);
+			CxPathListFree(&inputs);
+			return 1;
+		}
+	}
+
+	// Open the whole corpus up front, so reading it isn't part of any timing.
+	CxFile *files = (CxFile *) calloc(inputs.nPaths, sizeof(CxFile));
+	unsigned char *opened = (unsigned char *) calloc(inputs.nPaths, 1);
+	CxBenchResult *totals = (CxBenchResult *) calloc(nLevels * nDistBits * nSymBits, sizeof(CxBenchResult));
+	CxAshDecompressContext *dctx = CxAshDecompressContextCreate();
+	if (files == NULL || opened == NULL || totals == NULL || dctx == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		free(files);
+		free(opened);
+		free(totals);
+		CxAshDecompressContextDestroy(dctx);
+		CxPathListFree(&inputs);
+		return 1;
+	}
+	int nFailed = 0;
+	for (unsigned int i = 0; i < inputs.nPaths; i++) {
+		if (CxFileOpen(&files[i], inputs.paths[i]) != 0) {
+			fprintf(stderr, "Could not open %s for read access.\n", inputs.paths[i]);
+			nFailed++;
+		} else if (files[i].size > CX_ASH_MAX_SIZE) {
+			fprintf(stderr, "%s: File size (%zu bytes) exceeds maximum allowed size.\n", inputs.paths[i], files[i].size);
+			CxFileClose(&files[i]);
+			nFailed++;
+		} else {
+			opened[i] = 1;
+		}
+	}
+
+	BeginReport(&report);
+	int nTotals = 0;
+	for (int s = 0; s < nSymBits; s++) {
+		for (int d = 0; d < nDistBits; d++) {
+			for (int c = 0; c < nLevels; c++) {
+				CxAshCompressParams params;
+				CxAshCompressParamsInit(&params);
+				params.symBits = symBits[s];
+				params.distBits = distBits[d];
+				params.nPasses = (levels[c] == CX_LEVEL_AUTO) ? CX_AUTO_PASSES : (levels[c] > 0) ? (unsigned int) levels[c] : 0;
+				params.fastLevel = (levels[c] < 0 && levels[c] != CX_LEVEL_AUTO) ? (unsigned int) -levels[c] : 0;
+				params.nThreads = nThreads;
+
+				CxBenchResult *total = &totals[nTotals++];
+				total->name = "(total)";
+				total->symBits = symBits[s];
+				total->distBits = distBits[d];
+				total->level = levels[c];
+				total->peakKiB = -1;
+				total->ok = 1;
+				for (unsigned int i = 0; i < inputs.nPaths; i++) {
+					if (!opened[i]) continue;
+
+					CxBenchResult result;
+					BenchmarkFile(inputs.paths[i], files[i].data, files[i].size, &params, levels[c], nReps, dctx, &result);
+					WriteResult(&report, &result);
+					fflush(report.fp);
+					if (!result.ok) nFailed++;
+
+					total->size += result.size;
+					total->compressedSize += result.compressedSize;
+					total->compressMs += result.compressMs;
+					total->decompressMs += result.decompressMs;
+					if (result.peakKiB > total->peakKiB) total->peakKiB = result.peakKiB;
+					total->ok &= result.ok;
+				}
+			}
+		}
+	}
+	WriteTotals(&report, totals, nTotals);
+
+	for (unsigned int i = 0; i < inputs.nPaths; i++) {
+		if (opened[i]) CxFileClose(&files[i]);
+	}
+	if (report.fp != stdout) fclose(report.fp);
+	free(files);
+	free(opened);
+	free(totals);
+	CxAshDecompressContextDestroy(dctx);
+	CxPathListFree(&inputs);
+	return nFailed ? 1 : 0;
+}
@@ -0,0 +1,295 @@
+/* ASH0-tools "cache.c"
+ * Copyright (c) 2024 Garhoogin and NinjaCheetah
+ * This code is licensed under the MIT license. See LICENSE for more information.
+ *
+ * This file implements the on-disk cache ashcomp keeps its outputs in. It relies on POSIX file and directory
+ * access, elsewhere the cache can't be opened.
+ */
+#define _CRT_SECURE_NO_WARNINGS
+#include "cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CX_HAVE_CACHE
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#endif
+
+// ----- key hashing
+
+#define CX_HASH_PRIME1 0x9E3779B185EBCA87ull
+#define CX_HASH_PRIME2 0xC2B2AE3D27D4EB4Full
+#define CX_HASH_PRIME3 0x165667B19E3779F9ull
+
+static inline uint64_t CxiRotl64(uint64_t x, int n) {
+	return (x << n) | (x >> (64 - n));
+}
+
+static inline uint64_t CxiLoad64(const unsigned char *p) {
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint64_t CxiHashRound(uint64_t acc, uint64_t word) {
+	return CxiRotl64(acc + word * CX_HASH_PRIME2, 31) * CX_HASH_PRIME1;
+}
+
+// Spreads every bit of x over the whole result.
+static inline uint64_t CxiHashMix(uint64_t x) {
+	x ^= x >> 33;
+	x *= CX_HASH_PRIME2;
+	x ^= x >> 29;
+	x *= CX_HASH_PRIME3;
+	x ^= x >> 32;
+	return x;
+}
+
+// Hashes data to 128 bits, starting from the given seeds. Four lanes take 32 bytes at a time, so the multiplies
+// of one lane don't wait on those of the others.
+static void CxiHash128(const void *data, size_t size, uint64_t seed0, uint64_t seed1, uint64_t *out) {
+	const unsigned char *p = (const unsigned char *) data;
+	uint64_t v[4] = { seed0 + CX_HASH_PRIME1, seed1 + CX_HASH_PRIME2, seed0 ^ CX_HASH_PRIME3, seed1 - CX_HASH_PRIME1 };
+
+	size_t i = 0;
+	for (; i + 32 <= size; i += 32) {
+		v[0] = CxiHashRound(v[0], CxiLoad64(p + i + 0));
+		v[1] = CxiHashRound(v[1], CxiLoad64(p + i + 8));
+		v[2] = CxiHashRound(v[2], CxiLoad64(p + i + 16));
+		v[3] = CxiHashRound(v[3], CxiLoad64(p + i + 24));
+	}
+	for (int lane = 0; i + 8 <= size; i += 8, lane++) v[lane] = CxiHashRound(v[lane], CxiLoad64(p + i));
+
+	// The last few bytes are padded out with the length, so inputs differing only in trailing zeroes differ.
+	unsigned char tail[8] = { 0 };
+	memcpy(tail, p + i, size - i);
+	v[3] = CxiHashRound(v[3], CxiLoad64(tail) ^ ((uint64_t) size << 8));
+
+	const uint64_t a = CxiRotl64(v[0], 1) + CxiRotl64(v[1], 7) + CxiRotl64(v[2], 12) + CxiRotl64(v[3], 18);
+	const uint64_t b = CxiRotl64(v[0], 29) ^ CxiRotl64(v[1], 41) ^ CxiRotl64(v[2], 53) ^ v[3];
+	out[0] = CxiHashMix(a ^ size);
+	out[1] = CxiHashMix(b + a * CX_HASH_PRIME3);
+}
+
+void CxCacheKeyMake(CxCacheKey *key, const void *data, size_t size, const void *params, size_t nParams) {
+	// The settings are hashed with the data's hash as their seed.
+	uint64_t dataHash[2];
+	CxiHash128(data, size, 0, 0, dataHash);
+	CxiHash128(params, nParams, dataHash[0], dataHash[1], key->h);
+}
+
+
+// ----- cache directory
+
+#ifdef CX_HAVE_CACHE
+
+// Once a trim starts, it deletes entries until the cache is down to this fraction of its limit, so that it
+// isn't run again for every entry added after it.
+#define CX_CACHE_TRIM_PERCENT 90
+
+// Entries are named by the key in hexadecimal, then this suffix.
+#define CX_CACHE_SUFFIX     ".ash"
+#define CX_CACHE_NAME_CHARS (32 + 4)
+
+struct CxCache_ {
+	char *dir;
+	uint64_t maxSize;
+	uint64_t size;          // as of the last trim, plus the entries this process has added since
+	int lockfd;             // locked while trimming, against other processes
+	pthread_mutex_t lock;   // held while trimming or updating size, against other threads
+};
+
+typedef struct CxiCacheEntry_ {
+	char name[CX_CACHE_NAME_CHARS + 1];
+	uint64_t size;
+	time_t mtime;
+} CxiCacheEntry;
+
+static char *CxiCachePath(const CxCache *cache, const char *name) {
+	const size_t len = strlen(cache->dir) + 1 + strlen(name) + 1;
+	char *path = malloc(len);
+	if (path != NULL) snprintf(path, len, "%s/%s", cache->dir, name);
+	return path;
+}
+
+static char *CxiCacheEntryPath(const CxCache *cache, const CxCacheKey *key) {
+	char name[CX_CACHE_NAME_CHARS + 1];
+	snprintf(name, sizeof(name), "%016llx%016llx" CX_CACHE_SUFFIX, (unsigned long long) key->h[0],
+		(unsigned long long) key->h[1]);
+	return CxiCachePath(cache, name);
+}
+
+static int CxiIsEntryName(const char *name) {
+	if (strlen(name) != CX_CACHE_NAME_CHARS || strcmp(name + 32, CX_CACHE_SUFFIX) != 0) return 0;
+	for (int i = 0; i < 32; i++) {
+		if (!((name[i] >= '0' && name[i] <= '9') || (name[i] >= 'a' && name[i] <= 'f'))) return 0;
+	}
+	return 1;
+}
+
+static int CxiCompareEntryAge(const void *a, const void *b) {
+	const CxiCacheEntry *ea = (const CxiCacheEntry *) a, *eb = (const CxiCacheEntry *) b;
+	return (ea->mtime > eb->mtime) - (ea->mtime < eb->mtime);
+}
+
+// Measures the cache and, if it is over its limit, deletes the entries least recently used. Called with the
+// mutex held. Without a limit, this only measures.
+static void CxiCacheTrim(CxCache *cache) {
+	flock(cache->lockfd, LOCK_EX);
+
+	DIR *dir = opendir(cache->dir);
+	CxiCacheEntry *entries = NULL;
+	size_t nEntries = 0, nAlloc = 0;
+	uint64_t total = 0;
+	struct dirent *ent;
+	while (dir != NULL && (ent = readdir(dir)) != NULL) {
+		if (!CxiIsEntryName(ent->d_name)) continue;
+		char *path = CxiCachePath(cache, ent->d_name);
+		struct stat st;
+		if (path == NULL || stat(path, &st) != 0) {
+			free(path);
+			continue;
+		}
+		free(path);
+		total += st.st_size;
+
+		if (nEntries == nAlloc) {
+			nAlloc = nAlloc ? nAlloc * 2 : 256;
+			CxiCacheEntry *grown = realloc(entries, nAlloc * sizeof(CxiCacheEntry));
+			if (grown == NULL) break;
+			entries = grown;
+		}
+		CxiCacheEntry *entry = &entries[nEntries++];
+		memcpy(entry->name, ent->d_name, sizeof(entry->name));
+		entry->size = st.st_size;
+		entry->mtime = st.st_mtime;
+	}
+	if (dir != NULL) closedir(dir);
+
+	// Another process may be reading an entry as it is deleted, which is fine: the file lives on until it is
+	// closed.
+	if (cache->maxSize != 0 && total > cache->maxSize) {
+		const uint64_t target = cache->maxSize / 100 * CX_CACHE_TRIM_PERCENT;
+		qsort(entries, nEntries, sizeof(CxiCacheEntry), CxiCompareEntryAge);
+		for (size_t i = 0; i < nEntries && total > target; i++) {
+			char *path = CxiCachePath(cache, entries[i].name);
+			if (path != NULL && unlink(path) == 0) total -= entries[i].size;
+			free(path);
+		}
+	}
+	free(entries);
+	cache->size = total;
+
+	flock(cache->lockfd, LOCK_UN);
+}
+
+CxCache *CxCacheOpen(const char *dir, uint64_t maxSize) {
+	mkdir(dir, 0777);
+	if (access(dir, R_OK | W_OK | X_OK) != 0) return NULL;
+
+	CxCache *cache = calloc(1, sizeof(CxCache));
+	if (cache == NULL) return NULL;
+	cache->dir = strdup(dir);
+	cache->maxSize = maxSize;
+	char *lockpath = cache->dir != NULL ? CxiCachePath(cache, "lock") : NULL;
+	cache->lockfd = lockpath != NULL ? open(lockpath, O_RDWR | O_CREAT, 0666) : -1;
+	free(lockpath);
+	if (cache->lockfd < 0) {
+		free(cache->dir);
+		free(cache);
+		return NULL;
+	}
+	pthread_mutex_init(&cache->lock, NULL);
+
+	pthread_mutex_lock(&cache->lock);
+	CxiCacheTrim(cache);
+	pthread_mutex_unlock(&cache->lock);
+	return cache;
+}
+
+void CxCacheClose(CxCache *cache) {
+	if (cache == NULL) return;
+	close(cache->lockfd);
+	pthread_mutex_destroy(&cache->lock);
+	free(cache->dir);
+	free(cache);
+}
+
+int CxCacheGet(CxCache *cache, const CxCacheKey *key, CxFile *file) {
+	char *path = CxiCacheEntryPath(cache, key);
+	if (path == NULL) return 1;
+
+	int result = CxFileOpen(file, path);
+	if (result == 0) utimes(path, NULL); // recently used
+	free(path);
+	return result;
+}
+
+int CxCachePut(CxCache *cache, const CxCacheKey *key, const void *data, size_t size) {
+	char *path = CxiCacheEntryPath(cache, key);
+	char *tmppath = CxiCachePath(cache, ".tmp-XXXXXX");
+	int fd = (path != NULL && tmppath != NULL) ? mkstemp(tmppath) : -1;
+	if (fd < 0) {
+		free(path);
+		free(tmppath);
+		return 1;
+	}
+
+	// Temporary files are only readable by their owner, the entries of a shared cache need to be readable by all.
+	fchmod(fd, 0644);
+	size_t nWritten = 0;
+	while (nWritten < size) {
+		const ssize_t n = write(fd, (const unsigned char *) data + nWritten, size - nWritten);
+		if (n <= 0) break;
+		nWritten += n;
+	}
+	int result = close(fd) != 0 || nWritten != size;
+	if (result == 0) result = rename(tmppath, path) != 0;
+	if (result != 0) unlink(tmppath);
+	free(path);
+	free(tmppath);
+	if (result != 0) return result;
+
+	pthread_mutex_lock(&cache->lock);
+	cache->size += size;
+	if (cache->maxSize != 0 && cache->size > cache->maxSize) CxiCacheTrim(cache);
+	pthread_mutex_unlock(&cache->lock);
+	return 0;
+}
+
+#else
+
+CxCache *CxCacheOpen(const char *dir, uint64_t maxSize) {
+	(void) dir;
+	(void) maxSize;
+	return NULL;
+}
+
+void CxCacheClose(CxCache *cache) {
+	(void) cache;
+}
+
+int CxCacheGet(CxCache *cache, const CxCacheKey *key, CxFile *file) {
+	(void) cache;
+	(void) key;
+	(void) file;
+	return 1;
+}
+
+int CxCachePut(CxCache *cache, const CxCacheKey *key, const void *data, size_t size) {
+	(void) cache;
+	(void) key;
+	(void) data;
+	(void) size;
+	return 1;
+}
+
+#endif
@@ -0,0 +1,42 @@
+/* ASH0-tools "cache.h"
+ * Copyright (c) 2024 Garhoogin and NinjaCheetah
+ * This code is licensed under the MIT license. See LICENSE for more information.
+ *
+ * This file declares the on-disk cache ashcomp keeps its outputs in, so unchanged inputs aren't compressed again.
+ */
+#ifndef ASH_CACHE_H
+#define ASH_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "fileio.h"
+
+// Entries are named by a 128-bit hash of the input and of the settings it was compressed with. The hash is fast
+// rather than cryptographic, which is enough to tell apart the files of a build.
+typedef struct CxCacheKey_ {
+	uint64_t h[2];
+} CxCacheKey;
+
+// Hashes size bytes of data followed by nParams bytes of params, which hold whatever else decides the output.
+void CxCacheKeyMake(CxCacheKey *key, const void *data, size_t size, const void *params, size_t nParams);
+
+// A cache directory. Entries are written under a temporary name and renamed into place, so a reader never sees
+// one half written, and any number of threads and processes can share the directory. When the entries grow past
+// the size limit, the least recently used are deleted, a lock file keeping two trims from running at once.
+typedef struct CxCache_ CxCache;
+
+// Opens the cache in dir, creating the directory if needed. A maxSize of 0 means no limit. Returns NULL on
+// failure, or where the platform has no support for the cache.
+CxCache *CxCacheOpen(const char *dir, uint64_t maxSize);
+
+void CxCacheClose(CxCache *cache);
+
+// Looks up an entry, opening it into file on a hit, which marks it as recently used. Returns 0 on a hit.
+int CxCacheGet(CxCache *cache, const CxCacheKey *key, CxFile *file);
+
+// Stores an entry, replacing any with the same key, then trims the cache if it has grown too large. Returns 0
+// on success. A failure leaves the cache as it was.
+int CxCachePut(CxCache *cache, const CxCacheKey *key, const void *data, size_t size);
+
+#endif
@@ -0,0 +1,337 @@
+/* ASH0-tools "fileio.c"
+ * Copyright (c) 2024 Garhoogin and NinjaCheetah
+ * This code is licensed under the MIT license. See LICENSE for more information.
+ *
+ * This file implements the file access routines shared by ashcomp and ashdec. On POSIX systems files are
+ * memory mapped, elsewhere they fall back to buffered stdio. A path of "-" stands for standard input or output.
+ */
+#define _CRT_SECURE_NO_WARNINGS
+#include "fileio.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CX_HAVE_MMAP
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+// Size of the first buffer a stream of unknown size is read into. It is doubled each time it fills.
+#define CX_STREAM_CHUNK 0x10000
+
+int CxIsStdio(const char *path) {
+	return strcmp(path, "-") == 0;
+}
+
+// Returns standard input or output, put into binary mode where the platform would otherwise translate line endings.
+static FILE *CxiStdStream(FILE *fp) {
+#ifdef _WIN32
+	_setmode(_fileno(fp), _O_BINARY);
+#endif
+	return fp;
+}
+
+static char *CxiStrDup(const char *str) {
+	const size_t len = strlen(str);
+	char *copy = malloc(len + 1);
+	if (copy != NULL) memcpy(copy, str, len + 1);
+	return copy;
+}
+
+static void CxiFileReset(CxFile *file) {
+	file->data = NULL;
+	file->size = 0;
+	file->mapped = 0;
+	file->writable = 0;
+	file->fd = -1;
+	file->std = 0;
+	file->path = NULL;
+	file->tmpPath = NULL;
+	file->destPath = NULL;
+}
+
+#ifdef CX_HAVE_MMAP
+
+// Number of names tried for a temporary file before giving up.
+#define CX_TEMP_TRIES 100
+
+// Counts temporary files made by this process, so that threads writing beside the same path get different names.
+static atomic_uint sTempCounter;
+
+// Opens path for file->data to be written to. A regular file is not touched until the contents are complete: they
+// go to a new file beside it instead, which CxiFileCommit renames over it. Anything else, such as a device, is
+// written in place. Returns 0 on success.
+static int CxiFileBegin(CxFile *file, const char *path) {
+	struct stat st;
+	const int exists = stat(path, &st) == 0;
+	if (exists && !S_ISREG(st.st_mode)) {
+		file->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+		return file->fd < 0;
+	}
+
+	// Replace the file a symbolic link points to rather than the link itself.
+	file->destPath = exists ? realpath(path, NULL) : CxiStrDup(path);
+	if (file->destPath == NULL) return 1;
+	file->tmpPath = malloc(strlen(file->destPath) + 48);
+	if (file->tmpPath == NULL) return 1;
+
+	for (int i = 0; i < CX_TEMP_TRIES && file->fd < 0; i++) {
+		sprintf(file->tmpPath, "%s.%ld.%u.tmp", file->destPath, (long) getpid(), atomic_fetch_add(&sTempCounter, 1));
+		file->fd = open(file->tmpPath, O_RDWR | O_CREAT | O_EXCL, 0666);
+		if (file->fd < 0 && errno != EEXIST) break;
+	}
+	if (file->fd < 0) return 1;
+
+	// A file that is replaced keeps its permissions.
+	if (exists) fchmod(file->fd, st.st_mode & 07777);
+	return 0;
+}
+
+// Closes the descriptor opened by CxiFileBegin, and if written is nonzero, puts the contents in place. Otherwise
+// the temporary file is removed, leaving the path as it was. Returns 0 on success.
+static int CxiFileCommit(CxFile *file, int written) {
+	int result = !written;
+	if (file->fd >= 0 && close(file->fd) != 0) result = 1;
+	file->fd = -1;
+
+	if (file->tmpPath != NULL) {
+		if (result == 0 && rename(file->tmpPath, file->destPath) != 0) result = 1;
+		if (result != 0) remove(file->tmpPath);
+	}
+	free(file->tmpPath);
+	free(file->destPath);
+	file->tmpPath = NULL;
+	file->destPath = NULL;
+	return result;
+}
+
+#endif
+
+// Reads fp to its end, for streams such as pipes whose size isn't known up front.
+static int CxiFileReadStream(CxFile *file, FILE *fp) {
+	size_t nAlloc = CX_STREAM_CHUNK, size = 0;
+	unsigned char *data = malloc(nAlloc);
+	while (data != NULL) {
+		if (size == nAlloc) {
+			unsigned char *grown = realloc(data, nAlloc * 2);
+			if (grown == NULL) {
+				free(data);
+				data = NULL;
+				break;
+			}
+			data = grown;
+			nAlloc *= 2;
+		}
+		const size_t n = fread(data + size, 1, nAlloc - size, fp);
+		if (n == 0) break;
+		size += n;
+	}
+	if (data == NULL || ferror(fp)) {
+		free(data);
+		return 1;
+	}
+	file->data = data;
+	file->size = size;
+	return 0;
+}
+
+static int CxiFileReadStdio(CxFile *file, const char *path) {
+	if (CxIsStdio(path)) {
+		file->std = 1;
+		return CxiFileReadStream(file, CxiStdStream(stdin));
+	}
+
+	FILE *fp = fopen(path, "rb");
+	if (fp == NULL) return 1;
+
+	long size = -1;
+	if (fseek(fp, 0, SEEK_END) == 0) size = ftell(fp);
+	if (size < 0 || fseek(fp, 0, SEEK_SET) != 0) {
+		const int result = CxiFileReadStream(file, fp);
+		fclose(fp);
+		return result;
+	}
+
+	// Allocate at least one byte so that empty files still get a valid buffer.
+	file->data = malloc(size ? size : 1);
+	file->size = size;
+	if (file->data == NULL || fread(file->data, 1, size, fp) != (size_t) size) {
+		free(file->data);
+		CxiFileReset(file);
+		fclose(fp);
+		return 1;
+	}
+	fclose(fp);
+	return 0;
+}
+
+int CxFileOpen(CxFile *file, const char *path) {
+	CxiFileReset(file);
+
+#ifdef CX_HAVE_MMAP
+	// Standard input redirected from a file can be mapped like any other, as long as nothing has been read from it.
+	const int std = CxIsStdio(path);
+	const int fd = std ? dup(STDIN_FILENO) : open(path, O_RDONLY);
+	if (fd < 0) return 1;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || (std && lseek(fd, 0, SEEK_CUR) != 0)) {
+		// Not something that can be mapped, such as a pipe. Read it normally instead.
+		close(fd);
+		return CxiFileReadStdio(file, path);
+	}
+
+	file->size = st.st_size;
+	file->std = std;
+	if (file->size > 0) {
+		void *map = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED) {
+			close(fd);
+			return CxiFileReadStdio(file, path);
+		}
+		madvise(map, file->size, MADV_SEQUENTIAL);
+		file->data = map;
+		file->mapped = 1;
+	}
+	close(fd);
+	return 0;
+#else
+	return CxiFileReadStdio(file, path);
+#endif
+}
+
+int CxFileCreate(CxFile *file, const char *path, size_t size) {
+	CxiFileReset(file);
+	file->writable = 1;
+	file->size = size;
+	file->path = CxiStrDup(path);
+	if (file->path == NULL) return 1;
+	file->std = CxIsStdio(path);
+
+#ifdef CX_HAVE_MMAP
+	// Standard output can't be mapped, so its contents are built in memory as they are without mmap support.
+	if (!file->std) {
+		if (CxiFileBegin(file, path) != 0) {
+			CxiFileCommit(file, 0);
+			free(file->path);
+			CxiFileReset(file);
+			return 1;
+		}
+		if (size == 0) return 0;
+
+		if (ftruncate(file->fd, size) == 0) {
+			void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, file->fd, 0);
+			if (map != MAP_FAILED) {
+				file->data = map;
+				file->mapped = 1;
+				return 0;
+			}
+		}
+	}
+#endif
+
+	// Build the contents in memory, they are written out when the file is closed.
+	file->data = calloc(size ? size : 1, 1);
+	if (file->data == NULL) {
+		CxFileDiscard(file);
+		return 1;
+	}
+	return 0;
+}
+
+int CxFileClose(CxFile *file) {
+	int result = 0;
+
+	if (file->mapped) {
+#ifdef CX_HAVE_MMAP
+		munmap(file->data, file->size);
+#endif
+	} else {
+		if (file->writable && file->std) {
+			result = CxFileWrite(file->path, file->data, file->size);
+		} else if (file->writable) {
+#ifdef CX_HAVE_MMAP
+			// The file is already open, write the buffered contents through the descriptor.
+			size_t nWritten = 0;
+			while (nWritten < file->size) {
+				const ssize_t n = write(file->fd, file->data + nWritten, file->size - nWritten);
+				if (n <= 0) break;
+				nWritten += n;
+			}
+			result = nWritten != file->size;
+#else
+			result = CxFileWrite(file->path, file->data, file->size);
+#endif
+		}
+		free(file->data);
+	}
+
+#ifdef CX_HAVE_MMAP
+	if (file->writable && !file->std) {
+		if (CxiFileCommit(file, result == 0) != 0) result = 1;
+	} else if (file->fd >= 0 && close(file->fd) != 0) {
+		result = 1;
+	}
+#endif
+	free(file->path);
+	CxiFileReset(file);
+	return result;
+}
+
+void CxFileDiscard(CxFile *file) {
+	// Only a temporary file has been written to, and without mmap support nothing has been written at all.
+#ifdef CX_HAVE_MMAP
+	if (file->mapped) munmap(file->data, file->size);
+	else free(file->data);
+	CxiFileCommit(file, 0);
+#else
+	free(file->data);
+#endif
+	free(file->path);
+	CxiFileReset(file);
+}
+
+int CxFileWrite(const char *path, const void *data, size_t size) {
+	if (CxIsStdio(path)) {
+		FILE *fp = CxiStdStream(stdout);
+		const size_t nWritten = fwrite(data, 1, size, fp);
+		if (fflush(fp) != 0) return 1;
+		return nWritten != size;
+	}
+
+#ifdef CX_HAVE_MMAP
+	CxFile file;
+	CxiFileReset(&file);
+	if (CxiFileBegin(&file, path) != 0) {
+		CxiFileCommit(&file, 0);
+		return 1;
+	}
+
+	size_t nWritten = 0;
+	while (nWritten < size) {
+		const ssize_t n = write(file.fd, (const unsigned char *) data + nWritten, size - nWritten);
+		if (n <= 0) break;
+		nWritten += n;
+	}
+	return CxiFileCommit(&file, nWritten == size);
+#else
+	FILE *fp = fopen(path, "wb");
+	if (fp == NULL) return 1;
+
+	const size_t nWritten = fwrite(data, 1, size, fp);
+	if (fclose(fp) != 0) return 1;
+	return nWritten != size;
+#endif
+}
@@ -0,0 +1,49 @@
+/* ASH0-tools "fileio.h"
+ * Copyright (c) 2024 Garhoogin and NinjaCheetah
+ * This code is licensed under the MIT license. See LICENSE for more information.
+ *
+ * This file declares the file access routines shared by ashcomp and ashdec. A path of "-" stands for standard
+ * input when opening a file, and standard output when creating or writing one.
+ */
+#ifndef ASH_FILEIO_H
+#define ASH_FILEIO_H
+
+#include <stddef.h>
+
+// A whole file held in memory. Where supported, the file is memory mapped so its contents don't have to be
+// copied through a separate buffer; otherwise it is read into (or written out from) a heap buffer.
+typedef struct CxFile_ {
+	unsigned char *data;
+	size_t size;
+	int mapped;       // nonzero if data is a mapping of the file
+	int writable;     // nonzero if the file was opened with CxFileCreate
+	int fd;
+	int std;          // nonzero for standard input or output
+	char *path;       // output path, used for writing out a heap buffer on close
+	char *tmpPath;    // file the contents are written to, renamed to destPath on close
+	char *destPath;   // path tmpPath replaces, with any symbolic links resolved
+} CxFile;
+
+// Returns whether path is "-", which names standard input or output.
+int CxIsStdio(const char *path);
+
+// Opens an existing file for read access. Standard input is read to its end, unless it is redirected from a
+// regular file, which is mapped. Returns 0 on success.
+int CxFileOpen(CxFile *file, const char *path);
+
+// Creates (or replaces) a file of the given size whose contents are filled in through file->data before
+// CxFileClose is called. A regular file is written under a temporary name beside it and renamed into place on
+// close, so the path may name a file that is open for reading, even the input. Returns 0 on success.
+int CxFileCreate(CxFile *file, const char *path, size_t size);
+
+// Releases the file. For files opened with CxFileCreate this commits the contents. Returns 0 on success.
+int CxFileClose(CxFile *file);
+
+// Releases a file opened with CxFileCreate without committing its contents. Whatever was at the path before is
+// left as it was, and nothing is written to standard output until the file is closed.
+void CxFileDiscard(CxFile *file);
+
+// Writes size bytes from data to a file at path, replacing it as CxFileCreate does. Returns 0 on success.
+int CxFileWrite(const char *path, const void *data, size_t size);
+
+#endif
@@ -0,0 +1,139 @@
+/* ASH0-tools "pathlist.c"
+ * Copyright (c) 2024 Garhoogin and NinjaCheetah
+ * This code is licensed under the MIT license. See LICENSE for more information.
+ *
+ * This file implements the routines for gathering the input files of a batch.
+ */
+#define _CRT_SECURE_NO_WARNINGS
+#include "pathlist.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CX_HAVE_DIRENT
+#include <dirent.h>
+#endif
+
+void CxPathListInit(CxPathList *list) {
+	list->paths = NULL;
+	list->nPaths = 0;
+	list->nAlloc = 0;
+}
+
+void CxPathListFree(CxPathList *list) {
+	for (unsigned int i = 0; i < list->nPaths; i++) free(list->paths[i]);
+	free(list->paths);
+	CxPathListInit(list);
+}
+
+int CxPathListAdd(CxPathList *list, const char *path) {
+	if (list->nPaths == list->nAlloc) {
+		const unsigned int newAlloc = list->nAlloc ? list->nAlloc * 2 : 16;
+		char **paths = (char **) realloc(list->paths, newAlloc * sizeof(char *));
+		if (paths == NULL) return 1;
+		list->paths = paths;
+		list->nAlloc = newAlloc;
+	}
+
+	const size_t len = strlen(path);
+	char *copy = (char *) malloc(len + 1);
+	if (copy == NULL) return 1;
+	memcpy(copy, path, len + 1);
+	list->paths[list->nPaths++] = copy;
+	return 0;
+}
+
+int CxIsDirectory(const char *path) {
+	struct stat st;
+	if (stat(path, &st) != 0) return 0;
+	return (st.st_mode & S_IFMT) == S_IFDIR;
+}
+
+static int CxiHasSuffix(const char *str, const char *suffix) {
+	const size_t len = strlen(str), suffixLen = strlen(suffix);
+	return len >= suffixLen && strcmp(str + len - suffixLen, suffix) == 0;
+}
+
+static int CxiPathListAddDirectory(CxPathList *list, const char *dirpath, const char *suffix, int include) {
+#ifdef CX_HAVE_DIRENT
+	DIR *dir = opendir(dirpath);
+	if (dir == NULL) return 1;
+
+	int result = 0;
+	struct dirent *ent;
+	while (result == 0 && (ent = readdir(dir)) != NULL) {
+		if (ent->d_name[0] == '.') continue;
+		if (suffix != NULL && CxiHasSuffix(ent->d_name, suffix) != !!include) continue;
+
+		char *path = CxMakeOutputPath(ent->d_name, dirpath, "");
+		if (path == NULL) {
+			result = 1;
+			break;
+		}
+
+		struct stat st;
+		if (stat(path, &st) == 0 && (st.st_mode & S_IFMT) == S_IFREG) result = CxPathListAdd(list, path);
+		free(path);
+	}
+	closedir(dir);
+	return result;
+#else
+	(void) list;
+	(void) suffix;
+	(void) include;
+	fprintf(stderr, "Directory inputs are not supported on this platform: %s\n", dirpath);
+	return 1;
+#endif
+}
+
+int CxPathListAddInput(CxPathList *list, const char *path, const char *suffix, int include) {
+	if (CxIsDirectory(path)) return CxiPathListAddDirectory(list, path, suffix, include);
+	return CxPathListAdd(list, path);
+}
+
+int CxPathListAddListFile(CxPathList *list, const char *listpath) {
+	FILE *fp = fopen(listpath, "r");
+	if (fp == NULL) return 1;
+
+	int result = 0;
+	char line[4096];
+	while (result == 0 && fgets(line, sizeof(line), fp) != NULL) {
+		// Strip the line ending and skip blank lines.
+		size_t len = strlen(line);
+		while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) line[--len] = '\0';
+		if (len == 0) continue;
+
+		result = CxPathListAdd(list, line);
+	}
+	fclose(fp);
+	return result;
+}
+
+char *CxMakeOutputPath(const char *inpath, const char *outdir, const char *ext) {
+	const char *name = inpath;
+	size_t dirLen = 0;
+	if (outdir != NULL) {
+		// Keep only the file name of the input.
+		for (const char *p = inpath; *p; p++) {
+			if (*p == '/' || *p == '\\') name = p + 1;
+		}
+		dirLen = strlen(outdir);
+	}
+
+	const size_t nameLen = strlen(name), extLen = strlen(ext);
+	char *path = (char *) malloc(dirLen + 1 + nameLen + extLen + 1);
+	if (path == NULL) return NULL;
+
+	char *p = path;
+	if (outdir != NULL) {
+		memcpy(p, outdir, dirLen);
+		p += dirLen;
+		if (dirLen > 0 && outdir[dirLen - 1] != '/' && outdir[dirLen - 1] != '\\') *(p++) = '/';
+	}
+	memcpy(p, name, nameLen);
+	memcpy(p + nameLen, ext, extLen + 1);
+	return path;
+}
@@ -0,0 +1,37 @@
+/* ASH0-tools "pathlist.h"
+ * Copyright (c) 2024 Garhoogin and NinjaCheetah
+ * This code is licensed under the MIT license. See LICENSE for more information.
+ *
+ * This file declares the routines for gathering the input files of a batch.
+ */
+#ifndef ASH_PATHLIST_H
+#define ASH_PATHLIST_H
+
+typedef struct CxPathList_ {
+	char **paths;
+	unsigned int nPaths;
+	unsigned int nAlloc;
+} CxPathList;
+
+void CxPathListInit(CxPathList *list);
+void CxPathListFree(CxPathList *list);
+
+// Adds a path to the list. Returns 0 on success.
+int CxPathListAdd(CxPathList *list, const char *path);
+
+// Adds path, or if it names a directory, the regular files inside it (not recursing into subdirectories). When
+// adding a directory, only files whose names end with suffix are taken if include is nonzero, or only those that
+// don't if include is zero. Returns 0 on success.
+int CxPathListAddInput(CxPathList *list, const char *path, const char *suffix, int include);
+
+// Adds each line of a text file as a path, skipping blank lines. Returns 0 on success.
+int CxPathListAddListFile(CxPathList *list, const char *listpath);
+
+// Returns whether path names an existing directory.
+int CxIsDirectory(const char *path);
+
+// Builds the output path for inpath by appending ext. If outdir is not NULL, the output is placed in that
+// directory instead of next to the input. Returns a heap allocated string, or NULL on failure.
+char *CxMakeOutputPath(const char *inpath, const char *outdir, const char *ext);
+
+#endif
@@ -0,0 +1,291 @@
+/* ASH0-tools "pipeline.c"
+ * Copyright (c) 2024 Garhoogin and NinjaCheetah
+ * This code is licensed under the MIT license. See LICENSE for more information.
+ *
+ * This file implements the pipeline that overlaps reading and writing the files of a batch with the work done on
+ * them, on top of POSIX threads. Where those aren't available, files are read and written as they are asked for.
+ */
+#define _CRT_SECURE_NO_WARNINGS
+#include "pipeline.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CX_HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
+// Mapped inputs are read in by touching a byte of each page. Pages are at least this large everywhere mmap is.
+#define CX_PAGE_SIZE 4096
+
+// An output handed to the writer: either data to write to path, or a file to close.
+typedef struct CxiPipelineOutput_ {
+	unsigned int index;
+	char *path;
+	void *data;
+	size_t size;
+	CxFile file;
+	int isFile;
+} CxiPipelineOutput;
+
+struct CxPipeline_ {
+	char *const *paths;
+	unsigned int nPaths;
+	unsigned int depth;
+	unsigned char *writeFailed;    // one per input
+
+#ifdef CX_HAVE_PTHREADS
+	pthread_t reader;
+	pthread_t writer;
+	pthread_mutex_t lock;
+	pthread_cond_t inputRead;      // signaled when an input has been read
+	pthread_cond_t inputTaken;     // signaled when an input has been taken, making room for the next
+	pthread_cond_t outputPut;      // signaled when an output is handed over, or on shutdown
+	pthread_cond_t outputDone;     // signaled when the writer takes an output, making room for the next
+
+	// Inputs are read in order, nRead of them so far. Each is held until its job takes it.
+	CxFile *inputs;
+	unsigned char *readFailed;
+	unsigned char *taken;
+	unsigned int nRead;
+	unsigned int nTaken;
+
+	// Outputs wait in a ring of depth entries.
+	CxiPipelineOutput *outputs;
+	unsigned int outputHead;
+	unsigned int nOutputs;
+	int shutdown;
+#endif
+};
+
+// Brings the pages of a mapped file into memory, so that the job working on it doesn't stop for them.
+static void CxiPipelineFetch(const CxFile *file) {
+	if (!file->mapped) return;
+
+	volatile unsigned char sink = 0;
+	for (size_t i = 0; i < file->size; i += CX_PAGE_SIZE) sink ^= file->data[i];
+	(void) sink;
+}
+
+static void CxiPipelineCommit(CxPipeline *pipe, CxiPipelineOutput *output) {
+	const char *name = CxIsStdio(output->path) ? "standard output" : output->path;
+	if (output->isFile) {
+		if (CxFileClose(&output->file) != 0) {
+			fprintf(stderr, "Could not write %s.\n", name);
+			pipe->writeFailed[output->index] = 1;
+		}
+	} else {
+		if (CxFileWrite(output->path, output->data, output->size) != 0) {
+			fprintf(stderr, "Could not write %s.\n", name);
+			pipe->writeFailed[output->index] = 1;
+		}
+		free(output->data);
+	}
+	free(output->path);
+}
+
+#ifdef CX_HAVE_PTHREADS
+
+static void *CxiPipelineReader(void *param) {
+	CxPipeline *pipe = (CxPipeline *) param;
+
+	pthread_mutex_lock(&pipe->lock);
+	while (pipe->nRead < pipe->nPaths) {
+		while (!pipe->shutdown && pipe->nRead - pipe->nTaken >= pipe->depth) pthread_cond_wait(&pipe->inputTaken, &pipe->lock);
+		if (pipe->shutdown) break;
+
+		const unsigned int index = pipe->nRead;
+		pthread_mutex_unlock(&pipe->lock);
+		CxFile file;
+		const int failed = CxFileOpen(&file, pipe->paths[index]) != 0;
+		if (!failed) CxiPipelineFetch(&file);
+		pthread_mutex_lock(&pipe->lock);
+
+		pipe->inputs[index] = file;
+		pipe->readFailed[index] = failed;
+		pipe->nRead++;
+		pthread_cond_broadcast(&pipe->inputRead);
+	}
+	pthread_mutex_unlock(&pipe->lock);
+	return NULL;
+}
+
+static void *CxiPipelineWriter(void *param) {
+	CxPipeline *pipe = (CxPipeline *) param;
+
+	pthread_mutex_lock(&pipe->lock);
+	while (1) {
+		while (!pipe->shutdown && pipe->nOutputs == 0) pthread_cond_wait(&pipe->outputPut, &pipe->lock);
+		if (pipe->nOutputs == 0) break; // shut down, with nothing left to write
+
+		CxiPipelineOutput output = pipe->outputs[pipe->outputHead];
+		pipe->outputHead = (pipe->outputHead + 1) % pipe->depth;
+		pipe->nOutputs--;
+		pthread_cond_signal(&pipe->outputDone);
+		pthread_mutex_unlock(&pipe->lock);
+		CxiPipelineCommit(pipe, &output);
+		pthread_mutex_lock(&pipe->lock);
+	}
+	pthread_mutex_unlock(&pipe->lock);
+	return NULL;
+}
+
+static void CxiPipelinePut(CxPipeline *pipe, const CxiPipelineOutput *output) {
+	pthread_mutex_lock(&pipe->lock);
+	while (pipe->nOutputs == pipe->depth) pthread_cond_wait(&pipe->outputDone, &pipe->lock);
+	pipe->outputs[(pipe->outputHead + pipe->nOutputs) % pipe->depth] = *output;
+	pipe->nOutputs++;
+	pthread_cond_signal(&pipe->outputPut);
+	pthread_mutex_unlock(&pipe->lock);
+}
+
+#else
+
+static void CxiPipelinePut(CxPipeline *pipe, const CxiPipelineOutput *output) {
+	CxiPipelineOutput copy = *output;
+	CxiPipelineCommit(pipe, &copy);
+}
+
+#endif
+
+CxPipeline *CxPipelineCreate(char *const *paths, unsigned int nPaths, unsigned int depth) {
+	CxPipeline *pipe = (CxPipeline *) calloc(1, sizeof(CxPipeline));
+	if (pipe == NULL) return NULL;
+	pipe->paths = paths;
+	pipe->nPaths = nPaths;
+	pipe->depth = depth ? depth : 1;
+	pipe->writeFailed = (unsigned char *) calloc(nPaths ? nPaths : 1, 1);
+	if (pipe->writeFailed == NULL) {
+		free(pipe);
+		return NULL;
+	}
+
+#ifdef CX_HAVE_PTHREADS
+	pipe->inputs = (CxFile *) calloc(nPaths ? nPaths : 1, sizeof(CxFile));
+	pipe->readFailed = (unsigned char *) calloc(nPaths ? nPaths : 1, 1);
+	pipe->taken = (unsigned char *) calloc(nPaths ? nPaths : 1, 1);
+	pipe->outputs = (CxiPipelineOutput *) calloc(pipe->depth, sizeof(CxiPipelineOutput));
+	if (pipe->inputs == NULL || pipe->readFailed == NULL || pipe->taken == NULL || pipe->outputs == NULL) {
+		free(pipe->inputs);
+		free(pipe->readFailed);
+		free(pipe->taken);
+		free(pipe->outputs);
+		free(pipe->writeFailed);
+		free(pipe);
+		return NULL;
+	}
+
+	pthread_mutex_init(&pipe->lock, NULL);
+	pthread_cond_init(&pipe->inputRead, NULL);
+	pthread_cond_init(&pipe->inputTaken, NULL);
+	pthread_cond_init(&pipe->outputPut, NULL);
+	pthread_cond_init(&pipe->outputDone, NULL);
+
+	// The reader is started after the writer, so a failure leaves only the writer to stop.
+	int started = pthread_create(&pipe->writer, NULL, CxiPipelineWriter, pipe) == 0;
+	if (started && pthread_create(&pipe->reader, NULL, CxiPipelineReader, pipe) != 0) {
+		pthread_mutex_lock(&pipe->lock);
+		pipe->shutdown = 1;
+		pthread_cond_signal(&pipe->outputPut);
+		pthread_mutex_unlock(&pipe->lock);
+		pthread_join(pipe->writer, NULL);
+		started = 0;
+	}
+	if (!started) {
+		pthread_cond_destroy(&pipe->inputRead);
+		pthread_cond_destroy(&pipe->inputTaken);
+		pthread_cond_destroy(&pipe->outputPut);
+		pthread_cond_destroy(&pipe->outputDone);
+		pthread_mutex_destroy(&pipe->lock);
+		free(pipe->inputs);
+		free(pipe->readFailed);
+		free(pipe->taken);
+		free(pipe->outputs);
+		free(pipe->writeFailed);
+		free(pipe);
+		return NULL;
+	}
+#endif
+	return pipe;
+}
+
+void CxPipelineDestroy(CxPipeline *pipe, unsigned char *failed) {
+	if (pipe == NULL) return;
+
+#ifdef CX_HAVE_PTHREADS
+	pthread_mutex_lock(&pipe->lock);
+	pipe->shutdown = 1;
+	pthread_cond_broadcast(&pipe->inputTaken);
+	pthread_cond_broadcast(&pipe->outputPut);
+	pthread_mutex_unlock(&pipe->lock);
+	pthread_join(pipe->reader, NULL);
+	pthread_join(pipe->writer, NULL);
+
+	// Inputs read ahead that no job took are still open.
+	for (unsigned int i = 0; i < pipe->nRead; i++) {
+		if (!pipe->taken[i] && !pipe->readFailed[i]) CxFileClose(&pipe->inputs[i]);
+	}
+
+	pthread_cond_destroy(&pipe->inputRead);
+	pthread_cond_destroy(&pipe->inputTaken);
+	pthread_cond_destroy(&pipe->outputPut);
+	pthread_cond_destroy(&pipe->outputDone);
+	pthread_mutex_destroy(&pipe->lock);
+	free(pipe->inputs);
+	free(pipe->readFailed);
+	free(pipe->taken);
+	free(pipe->outputs);
+#endif
+
+	for (unsigned int i = 0; failed != NULL && i < pipe->nPaths; i++) failed[i] |= pipe->writeFailed[i];
+	free(pipe->writeFailed);
+	free(pipe);
+}
+
+int CxPipelineTake(CxPipeline *pipe, unsigned int index, CxFile *file) {
+#ifdef CX_HAVE_PTHREADS
+	pthread_mutex_lock(&pipe->lock);
+	while (index >= pipe->nRead) pthread_cond_wait(&pipe->inputRead, &pipe->lock);
+	const int failed = pipe->readFailed[index];
+	*file = pipe->inputs[index];
+	pipe->taken[index] = 1;
+	pipe->nTaken++;
+	pthread_cond_signal(&pipe->inputTaken);
+	pthread_mutex_unlock(&pipe->lock);
+	return failed;
+#else
+	return CxFileOpen(file, pipe->paths[index]);
+#endif
+}
+
+void CxPipelineWrite(CxPipeline *pipe, unsigned int index, const char *path, void *data, size_t size) {
+	CxiPipelineOutput output = { 0 };
+	output.index = index;
+	output.path = strdup(path);
+	output.data = data;
+	output.size = size;
+	if (output.path == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		pipe->writeFailed[index] = 1;
+		free(data);
+		return;
+	}
+	CxiPipelinePut(pipe, &output);
+}
+
+void CxPipelineClose(CxPipeline *pipe, unsigned int index, CxFile *file) {
+	CxiPipelineOutput output = { 0 };
+	output.index = index;
+	output.path = strdup(file->path);
+	output.file = *file;
+	output.isFile = 1;
+	if (output.path == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		pipe->writeFailed[index] = 1;
+		CxFileDiscard(file);
+		return;
+	}
+	CxiPipelinePut(pipe, &output);
+}
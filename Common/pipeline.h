@@ -0,0 +1,40 @@
+/* ASH0-tools "pipeline.h"
+ * Copyright (c) 2024 Garhoogin and NinjaCheetah
+ * This code is licensed under the MIT license. See LICENSE for more information.
+ *
+ * This file declares the pipeline that reads the inputs of a batch ahead of the jobs working on them, and writes
+ * their outputs behind them.
+ */
+#ifndef ASH_PIPELINE_H
+#define ASH_PIPELINE_H
+
+#include <stddef.h>
+
+#include "fileio.h"
+
+// Overlaps the file access of a batch with the work done on it. A reader thread opens the inputs in order and
+// reads each one in ahead of the job that takes it, and a writer thread commits the outputs the jobs hand it, so
+// that a job only waits on the disk (or on a pipe) when it falls behind. At most depth inputs are kept read but
+// not yet taken, and at most depth outputs waiting to be written. Where threads aren't available, each file is
+// read or written on the calling thread when it is asked for.
+typedef struct CxPipeline_ CxPipeline;
+
+// Starts reading the inputs at paths ahead. These are read in order, so jobs must take them in the order they
+// are handed out, as the thread pool does. Returns NULL on failure.
+CxPipeline *CxPipelineCreate(char *const *paths, unsigned int nPaths, unsigned int depth);
+
+// Waits for every output to be written and stops the threads, then sets the entry in failed of each output that
+// couldn't be.
+void CxPipelineDestroy(CxPipeline *pipe, unsigned char *failed);
+
+// Waits for input number index to be read, and hands it over to the caller, who closes it. Returns 0 on success.
+int CxPipelineTake(CxPipeline *pipe, unsigned int index, CxFile *file);
+
+// Hands over size bytes of data, allocated with malloc, to be written to a new file at path and then freed. This
+// waits until the writer has room for it.
+void CxPipelineWrite(CxPipeline *pipe, unsigned int index, const char *path, void *data, size_t size);
+
+// Hands over a file made by CxFileCreate, whose contents have been filled in, to be closed.
+void CxPipelineClose(CxPipeline *pipe, unsigned int index, CxFile *file);
+
+#endif
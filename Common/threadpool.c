@@ -0,0 +1,170 @@
+/* ASH0-tools "threadpool.c"
+ * Copyright (c) 2024 Garhoogin and NinjaCheetah
+ * This code is licensed under the MIT license. See LICENSE for more information.
+ *
+ * This file implements a minimal thread pool on top of POSIX threads. Where those aren't available, jobs
+ * simply run one after another on the calling thread.
+ */
+#include "threadpool.h"
+
+#include <stdlib.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CX_HAVE_PTHREADS
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+struct CxThreadPool_ {
+	unsigned int nThreads;
+
+#ifdef CX_HAVE_PTHREADS
+	pthread_t *threads;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;      // signaled when a new batch of jobs is posted, or on shutdown
+	pthread_cond_t done;      // signaled when the last job of a batch finishes
+
+	// Current batch. Workers claim jobs by incrementing nextJob under the lock.
+	CxJobProc proc;
+	void *param;
+	unsigned int nJobs;
+	unsigned int nextJob;
+	unsigned int nFinished;
+	unsigned int generation;  // incremented for each batch, so workers can tell a new one was posted
+	int shutdown;
+#endif
+};
+
+#ifdef CX_HAVE_PTHREADS
+
+static void CxiThreadPoolWork(CxThreadPool *pool, unsigned int thread) {
+	// Called with the lock held. Runs jobs from the current batch until none are left to claim.
+	while (pool->nextJob < pool->nJobs) {
+		const unsigned int index = pool->nextJob++;
+		pthread_mutex_unlock(&pool->lock);
+		pool->proc(pool->param, index, thread);
+		pthread_mutex_lock(&pool->lock);
+
+		if (++pool->nFinished == pool->nJobs) pthread_cond_broadcast(&pool->done);
+	}
+}
+
+typedef struct CxiWorkerParam_ {
+	CxThreadPool *pool;
+	unsigned int thread;
+} CxiWorkerParam;
+
+static void *CxiThreadPoolWorker(void *arg) {
+	CxiWorkerParam *param = (CxiWorkerParam *) arg;
+	CxThreadPool *pool = param->pool;
+	const unsigned int thread = param->thread;
+	free(param);
+
+	// The thread may only get going after the first batch is posted, so it counts batches from when the pool was
+	// created rather than from when it started.
+	pthread_mutex_lock(&pool->lock);
+	unsigned int generation = 0;
+	while (1) {
+		while (!pool->shutdown && pool->generation == generation) pthread_cond_wait(&pool->wake, &pool->lock);
+		if (pool->shutdown) break;
+
+		generation = pool->generation;
+		CxiThreadPoolWork(pool, thread);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+#endif
+
+unsigned int CxGetProcessorCount(void) {
+#if defined(CX_HAVE_PTHREADS) && defined(_SC_NPROCESSORS_ONLN)
+	const long n = sysconf(_SC_NPROCESSORS_ONLN);
+	if (n > 0) return (unsigned int) n;
+#endif
+	return 1;
+}
+
+CxThreadPool *CxThreadPoolCreate(unsigned int nThreads) {
+	if (nThreads == 0) nThreads = CxGetProcessorCount();
+
+	CxThreadPool *pool = (CxThreadPool *) calloc(1, sizeof(CxThreadPool));
+	if (pool == NULL) return NULL;
+
+#ifdef CX_HAVE_PTHREADS
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->wake, NULL);
+	pthread_cond_init(&pool->done, NULL);
+
+	// Thread 0 is whichever thread calls CxThreadPoolRun, so only the others need creating.
+	pool->nThreads = 1;
+	pool->threads = (pthread_t *) calloc(nThreads, sizeof(pthread_t));
+	if (pool->threads == NULL) {
+		CxThreadPoolDestroy(pool);
+		return NULL;
+	}
+	for (unsigned int i = 1; i < nThreads; i++) {
+		CxiWorkerParam *param = (CxiWorkerParam *) malloc(sizeof(CxiWorkerParam));
+		if (param == NULL) break;
+		param->pool = pool;
+		param->thread = i;
+		if (pthread_create(&pool->threads[i], NULL, CxiThreadPoolWorker, param) != 0) {
+			free(param);
+			break;
+		}
+		pool->nThreads++;
+	}
+#else
+	(void) nThreads;
+	pool->nThreads = 1;
+#endif
+	return pool;
+}
+
+void CxThreadPoolDestroy(CxThreadPool *pool) {
+	if (pool == NULL) return;
+
+#ifdef CX_HAVE_PTHREADS
+	pthread_mutex_lock(&pool->lock);
+	pool->shutdown = 1;
+	pthread_cond_broadcast(&pool->wake);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (unsigned int i = 1; i < pool->nThreads; i++) pthread_join(pool->threads[i], NULL);
+	free(pool->threads);
+
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->wake);
+	pthread_cond_destroy(&pool->done);
+#endif
+	free(pool);
+}
+
+unsigned int CxThreadPoolSize(const CxThreadPool *pool) {
+	return pool->nThreads;
+}
+
+void CxThreadPoolRun(CxThreadPool *pool, unsigned int nJobs, CxJobProc proc, void *param) {
+	if (nJobs == 0) return;
+
+#ifdef CX_HAVE_PTHREADS
+	if (pool->nThreads > 1) {
+		pthread_mutex_lock(&pool->lock);
+		pool->proc = proc;
+		pool->param = param;
+		pool->nJobs = nJobs;
+		pool->nextJob = 0;
+		pool->nFinished = 0;
+		pool->generation++;
+		pthread_cond_broadcast(&pool->wake);
+
+		// Help out with the batch, then wait on whatever jobs the other threads are still running.
+		CxiThreadPoolWork(pool, 0);
+		while (pool->nFinished < pool->nJobs) pthread_cond_wait(&pool->done, &pool->lock);
+		pthread_mutex_unlock(&pool->lock);
+		return;
+	}
+#endif
+
+	for (unsigned int i = 0; i < nJobs; i++) proc(param, i, 0);
+}
@@ -0,0 +1,30 @@
+/* ASH0-tools "threadpool.h"
+ * Copyright (c) 2024 Garhoogin and NinjaCheetah
+ * This code is licensed under the MIT license. See LICENSE for more information.
+ *
+ * This file declares a minimal thread pool for running batches of independent jobs.
+ */
+#ifndef ASH_THREADPOOL_H
+#define ASH_THREADPOOL_H
+
+// Runs job number index on the pool thread numbered thread. Thread numbers are below CxThreadPoolSize(), so
+// they can be used to index per-thread scratch data.
+typedef void (*CxJobProc)(void *param, unsigned int index, unsigned int thread);
+
+typedef struct CxThreadPool_ CxThreadPool;
+
+// Creates a pool of nThreads threads, counting the thread that calls CxThreadPoolRun. Passing 0 uses one
+// thread per processor. Returns NULL on failure.
+CxThreadPool *CxThreadPoolCreate(unsigned int nThreads);
+
+void CxThreadPoolDestroy(CxThreadPool *pool);
+
+unsigned int CxThreadPoolSize(const CxThreadPool *pool);
+
+// Runs jobs 0 through nJobs - 1, each handed out to the next free thread. Returns once all jobs are done.
+void CxThreadPoolRun(CxThreadPool *pool, unsigned int nJobs, CxJobProc proc, void *param);
+
+// Number of processors available to this process.
+unsigned int CxGetProcessorCount(void);
+
+#endif
@@ -2,7 +2,7 @@
  * Copyright (c) 2024 Garhoogin and NinjaCheetah
  * This code is licensed under the MIT license. See LICENSE for more information.
  *
- * This file implements the decompression routines for extracting Nintendo's ASH0 files used on the Wii.
+ * This file implements the command line interface for extracting Nintendo's ASH0 files used on the Wii.
  */
 #define _CRT_SECURE_NO_WARNINGS
 #include <stdio.h>
@@ -10,269 +10,349 @@
 #include <string.h>
 #include <stdint.h>
 
-typedef uint32_t u32;
-typedef uint16_t u16;
-typedef uint8_t u8;
+#include "ash0.h"
+#include "fileio.h"
+#include "pathlist.h"
+#include "pipeline.h"
+#include "threadpool.h"
 
-#define TREE_RIGHT    0x80000000
-#define TREE_LEFT     0x40000000
-#define TREE_VAL_MASK 0x3FFFFFFF
+typedef struct CxDecompressBatch_ {
+	CxPathList inputs;
+	const char *outpath;           // output file when decompressing a single file
+	const char *outdir;            // output directory, if any
+	int nSymBits;                  // 0 to detect the widths of each file
+	int nDistBits;
+	int parallel;                  // decode the distance stream on its own thread
+	FILE *stats;                   // where to print what was decoded from each file, if anywhere
+	int index;                     // write an index beside each input, for decoding parts of it later
+	int range;                     // decompress only rangeSize bytes from rangeOffset
+	uint32_t rangeOffset;
+	uint32_t rangeSize;
+	CxPipeline *pipeline;          // reads the inputs ahead and writes the outputs behind
+	CxAshDecompressContext **ctx;  // one per thread
+	unsigned char *failed;         // one per input
+} CxDecompressBatch;
 
-// If invalid data is found during decompression, jumo here and print the line the error was encountered on.
-static void AbortInvalidData(const int line) {
-	fprintf(stderr, "!!! Invalid compressed data.\n");
-	fprintf(stderr, "    Line %d\n", line);
-	exit(1);
-}
-
-// Assertions for compression, if one fails then call AbortInvalidData().
-#define CX_ASSERT(x)   if(!(x))AbortInvalidData(__LINE__)
+// Writes the index of a file just decompressed beside it. Returns 0 on success.
+static int WriteIndex(CxAshDecompressContext *ctx, const char *inpath, const CxFile *infile, const CxFile *outfile,
+	int nSymBits, int nDistBits) {
+	const void *index;
+	size_t indexSize;
+	int result = CxAshBuildIndex(ctx, infile->data, infile->size, outfile->data, outfile->size, nSymBits, nDistBits, 0,
+		&index, &indexSize);
+	if (result != CX_ASH_OK) {
+		fprintf(stderr, "%s: Could not build the index. %s\n", inpath, CxAshErrorString(result));
+		return 1;
+	}
 
-// Most systems this code will be run on will be little endian, so all big endian data must be converted.
-u32 BigToLittle32(const u32 i)  {
-	return (i >> 24 | i << 24 | (i & 0x00FF0000) >> 8 | (i & 0x0000FF00) << 8);
+	char *indexpath = CxMakeOutputPath(inpath, NULL, ".idx");
+	if (indexpath == NULL || CxFileWrite(indexpath, index, indexSize) != 0) {
+		fprintf(stderr, "Could not open %s.idx for write access.\n", inpath);
+		free(indexpath);
+		return 1;
+	}
+	free(indexpath);
+	return 0;
 }
 
+// Decompresses part of one file, using the index beside it if there is one. Returns 0 on success.
+static int DecompressRange(CxAshDecompressContext *ctx, CxPipeline *pipeline, unsigned int index, const char *inpath,
+	const char *outpath, int nSymBits, int nDistBits, uint32_t offset, uint32_t size) {
+	CxFile infile;
+	if (CxPipelineTake(pipeline, index, &infile) != 0) {
+		fprintf(stderr, "Could not open %s for read access.\n", inpath);
+		return 1;
+	}
 
-typedef struct CxBitReader_ {
-	const u8 *srcp;
-	u32 size;
-	u32 srcpos;
-	u32 word;
-	u32 bitCapacity;
-} CxBitReader;
+	// The index records the widths. Without one, they are detected if asked to, and decoding starts from the
+	// beginning. Standard input has nothing beside it.
+	CxFile indexfile;
+	char *indexpath = CxIsStdio(inpath) ? NULL : CxMakeOutputPath(inpath, NULL, ".idx");
+	int hasIndex = indexpath != NULL && CxFileOpen(&indexfile, indexpath) == 0;
+	free(indexpath);
+	int result = CX_ASH_OK;
+	if (hasIndex) {
+		nSymBits = nDistBits = 0;
+	} else if (nSymBits == 0 || nDistBits == 0) {
+		result = CxAshDetectBits(ctx, infile.data, infile.size, &nSymBits, &nDistBits);
+	}
 
-static void CxBitReaderFeedWord(CxBitReader *reader) {
-	//bounds check the source data to prevent a buffer overrun
-	CX_ASSERT(reader->srcpos + 4 <= reader->size);
-	
-	reader->word = BigToLittle32(*(const u32 *) (reader->srcp + reader->srcpos));
-	reader->bitCapacity = 0;
-	reader->srcpos += 4;
-}
+	CxFile outfile;
+	if (result == CX_ASH_OK && CxFileCreate(&outfile, outpath, size) != 0) {
+		fprintf(stderr, "Could not open %s for write access.\n", outpath);
+		if (hasIndex) CxFileClose(&indexfile);
+		CxFileClose(&infile);
+		return 1;
+	}
+	if (result == CX_ASH_OK) {
+		result = CxAshDecompressRange(ctx, infile.data, infile.size, hasIndex ? indexfile.data : NULL,
+			hasIndex ? indexfile.size : 0, nSymBits, nDistBits, offset, outfile.data, size);
+		if (result != CX_ASH_OK) CxFileDiscard(&outfile);
+	}
+	if (hasIndex) CxFileClose(&indexfile);
+	CxFileClose(&infile);
+	if (result != CX_ASH_OK) {
+		fprintf(stderr, "%s: %s\n", inpath, CxAshErrorString(result));
+		return 1;
+	}
 
-void CxBitReaderInit(CxBitReader *reader, const u8 *src, u32 size, u32 startpos) {
-	reader->srcp = src;
-	reader->size = size;
-	reader->srcpos = startpos;
-	CxBitReaderFeedWord(reader);
+	CxPipelineClose(pipeline, index, &outfile);
+	return 0;
 }
 
-int CxBitReaderReadBit(CxBitReader *reader) {
-	const int bit = reader->word >> 31;
-	if (reader->bitCapacity == 31) {
-		CxBitReaderFeedWord(reader);
-	} else {
-		reader->bitCapacity++;
-		reader->word <<= 1;
+// Decompresses one file. Returns 0 on success.
+static int DecompressFile(CxAshDecompressContext *ctx, CxPipeline *pipeline, unsigned int index, const char *inpath,
+	const char *outpath, int nSymBits, int nDistBits, int parallel, FILE *stats, int writeIndex) {
+	// Take the input file, read in ahead by the pipeline. This fails if it couldn't be.
+	CxFile infile;
+	if (CxPipelineTake(pipeline, index, &infile) != 0) {
+		fprintf(stderr, "Could not open %s for read access.\n", inpath);
+		return 1;
 	}
-	return bit;
-}
 
-u32 CxBitReaderReadBits(CxBitReader *reader, const int nBits) {
-	u32 bits;
-	const u32 next = reader->bitCapacity + nBits;
-	if (next <= 32) {
-		bits  = reader->word >> (32 - nBits);
-		if (next != 32) {
-			reader->word <<= nBits;
-			reader->bitCapacity += nBits;
-		} else {
-			CxBitReaderFeedWord(reader);
-		}
-	} else {
-		bits = reader->word >> (32 - nBits);
-		CxBitReaderFeedWord(reader);
-		bits |= (reader->word >> (64 - next));
-		reader->word <<= (next - 32);
-		reader->bitCapacity = next - 32;
+	// Check the magic number and ensure it's actually "ASH0".
+	if (infile.size < 4 || memcmp(infile.data, "ASH0", 4) != 0) {
+		fprintf(stderr, "%s is not a valid ASH file!\n", inpath);
+		CxFileClose(&infile);
+		return 1;
+	}
+	uint32_t uncompressedSize;
+	int result = CxAshGetUncompressedSize(infile.data, infile.size, &uncompressedSize);
+	if (result != CX_ASH_OK) {
+		fprintf(stderr, "%s: %s\n", inpath, CxAshErrorString(result));
+		CxFileClose(&infile);
+		return 1;
 	}
-	return bits;
-}
 
-u32 CxAshReadTree(CxBitReader *reader, int width, u32 *leftTree, u32 *rightTree) {
-	u32 *work = calloc(2 * (1 << width), sizeof(u32));
-	
-	u32 r23 = (1 << width);
-	u32 symRoot;
-	u32 nNodes = 0;
-	do {
-		if (CxBitReaderReadBit(reader)) {
-			*work++ = r23 | TREE_RIGHT;
-			*work++ = r23 | TREE_LEFT;
-			nNodes += 2;
-			r23++;
-		} else {
-			symRoot = CxBitReaderReadBits(reader, width);
-			do {
-				const u32 nodeval = *--work;
-				const u32 idx = nodeval & TREE_VAL_MASK;
-				nNodes--;
-				if (nodeval & TREE_RIGHT) {
-					rightTree[idx] = symRoot;
-					symRoot = idx;
-				} else {
-					leftTree[idx] = symRoot;
-					break;
-				}
-			} while (nNodes > 0);
+	// Widths left to detect are worked out before anything is written.
+	if (nSymBits == 0 || nDistBits == 0) {
+		result = CxAshDetectBits(ctx, infile.data, infile.size, &nSymBits, &nDistBits);
+		if (result != CX_ASH_OK) {
+			fprintf(stderr, "%s: Could not detect the tree widths. %s\n", inpath, CxAshErrorString(result));
+			CxFileClose(&infile);
+			return 1;
 		}
-	} while (nNodes > 0);
-	
-	free(work);
+	}
 
-	return symRoot;
-}
+	// Create the output file at its final size and ensure that it can be written to.
+	CxFile outfile;
+	if (CxFileCreate(&outfile, outpath, uncompressedSize) != 0) {
+		fprintf(stderr, "Could not open %s for write access.\n", outpath);
+		CxFileClose(&infile);
+		return 1;
+	}
 
+	// Decompress straight into the output file. Make sure an incomplete file isn't left behind if that fails.
+	if (parallel) {
+		result = CxAshDecompressParallel(ctx, infile.data, infile.size, outfile.data, outfile.size, nSymBits, nDistBits);
+	} else {
+		result = CxAshDecompress(ctx, infile.data, infile.size, outfile.data, outfile.size, nSymBits, nDistBits);
+	}
+	if (result != CX_ASH_OK) {
+		fprintf(stderr, "%s: %s\n", inpath, CxAshErrorString(result));
+		CxFileClose(&infile);
+		CxFileDiscard(&outfile);
+		return 1;
+	}
 
-u8 *CxUncompressAsh(const u8 *inbuf, u32 size, u32 *outlen, int symBits, int distBits) {
-	u32 uncompSize = BigToLittle32(*(u32 *) (inbuf + 4)) & 0x00FFFFFF;
-	const u32 outSize = uncompSize;
-	
-	u8 *outbuf = calloc(uncompSize, 1);
-	u8 *destp = outbuf;
-	
-	CxBitReader reader, reader2;
-	CxBitReaderInit(&reader, inbuf, size, BigToLittle32(*(const u32 *) (inbuf + 0x8)));
-	CxBitReaderInit(&reader2, inbuf, size, 0xC);
-	
-	const u32 symMax = (1 << symBits);
-	const u32 distMax = (1 << distBits);
+	// Building the index decodes the file again, so take the counts for --stats from the first decode.
+	CxAshDecompressInfo info;
+	CxAshDecompressGetInfo(ctx, &info);
+	if (writeIndex && WriteIndex(ctx, inpath, &infile, &outfile, nSymBits, nDistBits) != 0) {
+		CxFileClose(&infile);
+		CxFileDiscard(&outfile);
+		return 1;
+	}
+	CxFileClose(&infile);
 
-	u32 *symLeftTree   = calloc(2 * symMax - 1, sizeof(u32));
-	u32 *symRightTree  = calloc(2 * symMax - 1, sizeof(u32));
-	u32 *distLeftTree  = calloc(2 * distMax - 1, sizeof(u32));
-	u32 *distRightTree = calloc(2 * distMax - 1, sizeof(u32));
+	// The output is committed while the next file is decompressed.
+	CxPipelineClose(pipeline, index, &outfile);
 
-	u32 symRoot = CxAshReadTree(&reader2, symBits, symLeftTree, symRightTree);
-	u32 distRoot = CxAshReadTree(&reader, distBits, distLeftTree, distRightTree);
-	
-	// Main decompression loop.
-	do {
-		u32 sym = symRoot;
-		while (sym >= symMax) {
-			if (!CxBitReaderReadBit(&reader2)) {
-				sym = symLeftTree[sym];
-			} else {
-				sym = symRightTree[sym];
-			}
-		}
-		
-		if (sym < 0x100) {
-			*(destp++) = sym;
-			uncompSize--;
-		} else {
-			u32 distsym = distRoot;
-			while (distsym >= distMax) {
-				if (!CxBitReaderReadBit(&reader)) {
-					distsym = distLeftTree[distsym];
-				} else {
-					distsym = distRightTree[distsym];
-				}
-			}
-			
-			u32 copylen = (sym - 0x100) + 3;
-			const u8 *srcp = destp - distsym - 1;
-			CX_ASSERT(copylen <= uncompSize);             //assert length valid
-			CX_ASSERT((destp - outbuf) >= (distsym + 1)); //assert source valid
-			
-			uncompSize -= copylen;
-			while (copylen--) {
-				*(destp++) = *(srcp++);
-			}
-		}
-	} while (uncompSize > 0);
-	
-	free(symLeftTree);
-	free(symRightTree);
-	free(distLeftTree);
-	free(distRightTree);
-	
-	*outlen = outSize;
-	return outbuf;
+	if (stats != NULL) {
+		// Files may be decompressed side by side, so put the whole report together before printing it.
+		char buf[1024];
+		int len = 0;
+		len += snprintf(buf + len, sizeof(buf) - len, "%s: %u bytes\n", inpath, uncompressedSize);
+		len += snprintf(buf + len, sizeof(buf) - len, "  widths     %d symbol bits, %d distance bits\n", nSymBits, nDistBits);
+		len += snprintf(buf + len, sizeof(buf) - len, "  symbols    %u (%u literals, %u matches)\n",
+			info.nLiterals + info.nMatches, info.nLiterals, info.nMatches);
+		len += snprintf(buf + len, sizeof(buf) - len, "  bits       %llu symbol stream, %llu distance stream\n",
+			(unsigned long long) info.symStreamBits, (unsigned long long) info.distStreamBits);
+		len += snprintf(buf + len, sizeof(buf) - len, "  copied     %u bytes\n", info.nCopyBytes);
+		fputs(buf, stats);
+	}
+	return 0;
 }
 
+static void DecompressJob(void *param, unsigned int index, unsigned int thread) {
+	CxDecompressBatch *batch = (CxDecompressBatch *) param;
+	const char *inpath = batch->inputs.paths[index];
+
+	// Set output file name (if one is not specified). If no output file is specified, append .arc to the
+	// input name, or for standard input, write to standard output.
+	char *outpath = NULL;
+	if (batch->outpath != NULL) {
+		outpath = strdup(batch->outpath);
+	} else if (CxIsStdio(inpath)) {
+		outpath = strdup(inpath);
+	} else {
+		outpath = CxMakeOutputPath(inpath, batch->outdir, ".arc");
+	}
+	if (outpath == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		batch->failed[index] = 1;
+		return;
+	}
 
+	if (batch->range) {
+		batch->failed[index] = DecompressRange(batch->ctx[thread], batch->pipeline, index, inpath, outpath,
+			batch->nSymBits, batch->nDistBits, batch->rangeOffset, batch->rangeSize) != 0;
+	} else {
+		batch->failed[index] = DecompressFile(batch->ctx[thread], batch->pipeline, index, inpath, outpath,
+			batch->nSymBits, batch->nDistBits, batch->parallel, batch->stats, batch->index) != 0;
+	}
+	free(outpath);
+}
 
 int main(const int argc, char **argv) {
-	// Syntax: ashdec <infile> [option...]
+	// Syntax: ashdec <infile...> [option...]
 	if (argc < 2) {
 		puts("ashdec v1.0 by Garhoogin and NinjaCheetah\n");
-		puts("Usage: ashdec <infile> [optional arguments]\n");
+		puts("Usage: ashdec <infile...> [optional arguments]\n");
 		puts("Arguments:");
-		puts(" -o <f> Specify output file path");
-		puts(" -d <n> Specify distance tree bits  (default: 11)");
-		puts(" -l <n> Specify length tree bits    (default:  9)");
+		puts(" -o <f> Specify output file path, or output directory for several inputs");
+		puts(" -d <n> Specify distance tree bits  (default: 11, auto=detect)");
+		puts(" -l <n> Specify length tree bits    (default:  9, auto=detect)");
+		puts(" -i <f> Read input paths from a list file, one per line");
+		puts(" -j <n> Number of files to decompress at once (default: one per processor)");
+		puts(" -x     Write an index beside each input, for decompressing parts of it with -r");
+		puts(" -r <offset>:<size> Decompress only size bytes from offset, using the index beside the input if any");
+		puts(" --stats Print the symbols, bits and match bytes decoded from each file");
+		puts("");
+		puts("Inputs that are directories are expanded to the .ash files inside them. An input of - reads standard");
+		puts("input, decompressing it to standard output unless -o names a file, and -o - writes to standard output.");
 		puts("");
 		return 1;
 	}
 	
 	// Process arguments passed on the command line.
-	const char *outpath = NULL;
-	const char *inpath = argv[1];
+	CxDecompressBatch batch = { 0 };
+	CxPathListInit(&batch.inputs);
+	const char *outarg = NULL;
+	unsigned int nThreads = 0;
 	// Default values. These work for ASH0 files found in the System Menu and Animal Crossing: City Folk. ASH0 files
-	// found in My Pokémon Ranch require setting the distance tree bits to 15 instead.
-	int nSymBits = 9, nDistBits = 11;
-	for (int i = 2; i < argc; i++) {
+	// found in My Pokémon Ranch require setting the distance tree bits to 15 instead, or detecting them.
+	batch.nSymBits = 9;
+	batch.nDistBits = 11;
+	int usesDirectory = 0;
+	int stats = 0;
+	for (int i = 1; i < argc; i++) {
+		int error = 0;
 		if (strcmp(argv[i], "-o") == 0) {
 			i++;
-			if (i < argc) outpath = argv[i];
+			if (i < argc) outarg = argv[i];
 		} else if (strcmp(argv[i], "-d") == 0) {
 			i++;
-			if (i < argc) nDistBits = atoi(argv[i]);
+			if (i < argc) batch.nDistBits = (strcmp(argv[i], "auto") == 0) ? 0 : atoi(argv[i]);
 		} else if (strcmp(argv[i], "-l") == 0) {
 			i++;
-			if (i < argc) nSymBits = atoi(argv[i]);
+			if (i < argc) batch.nSymBits = (strcmp(argv[i], "auto") == 0) ? 0 : atoi(argv[i]);
+		} else if (strcmp(argv[i], "-j") == 0) {
+			i++;
+			if (i < argc) nThreads = atoi(argv[i]);
+		} else if (strcmp(argv[i], "--stats") == 0) {
+			stats = 1;
+		} else if (strcmp(argv[i], "-x") == 0) {
+			batch.index = 1;
+		} else if (strcmp(argv[i], "-r") == 0) {
+			i++;
+			if (i < argc) {
+				// Either number may be given in hexadecimal, with a leading 0x.
+				char *end;
+				batch.rangeOffset = (uint32_t) strtoul(argv[i], &end, 0);
+				error = *end != ':';
+				if (!error) batch.rangeSize = (uint32_t) strtoul(end + 1, &end, 0);
+				error = error || *end != '\0';
+				if (error) fprintf(stderr, "Invalid range %s, expected <offset>:<size>.\n", argv[i]);
+				batch.range = 1;
+			}
+		} else if (strcmp(argv[i], "-i") == 0) {
+			i++;
+			if (i < argc) error = CxPathListAddListFile(&batch.inputs, argv[i]);
+			if (error) fprintf(stderr, "Could not read the list file %s.\n", argv[i]);
+		} else {
+			if (CxIsDirectory(argv[i])) usesDirectory = 1;
+			error = CxPathListAddInput(&batch.inputs, argv[i], ".ash", 1);
+			if (error) fprintf(stderr, "Could not read the directory %s.\n", argv[i]);
+		}
+		if (error) {
+			CxPathListFree(&batch.inputs);
+			return 1;
 		}
 	}
-
-	// Open the input file and ensure it can be read from.
-	FILE *fp = fopen(inpath, "rb");
-	if (fp == NULL) {
-		fprintf(stderr, "Could not open %s for read access.\n", inpath);
+	if (batch.inputs.nPaths == 0) {
+		fprintf(stderr, "No input files.\n");
+		CxPathListFree(&batch.inputs);
 		return 1;
 	}
 
-	// Read the magic number and ensure it's actually "ASH0".
-	char magic[4];
-	fread(magic, sizeof(magic), 1, fp);
-	if (memcmp(magic, "ASH0", 4) != 0) {
-		printf("This is not a valid ASH file!\n");
-		return 1;
+	// With a single input file, -o names the output file. Otherwise it names the directory to put them in.
+	if (outarg != NULL) {
+		if (batch.inputs.nPaths == 1 && !usesDirectory && !CxIsDirectory(outarg)) batch.outpath = outarg;
+		else batch.outdir = outarg;
 	}
 
-	// Read input file.
-	fseek(fp, 0, SEEK_END);
-	const u32 size = ftell(fp);
-	fseek(fp, 0, SEEK_SET);
+	// Standard input can only be read once, and only one output can go to standard output. Messages then go to
+	// standard error, out of the output's way.
+	int nStdin = 0;
+	for (unsigned int i = 0; i < batch.inputs.nPaths; i++) nStdin += CxIsStdio(batch.inputs.paths[i]);
+	const int toStdout = (batch.outpath != NULL) ? CxIsStdio(batch.outpath) : nStdin > 0;
+	const char *stdioError = NULL;
+	if (nStdin > 1) stdioError = "Standard input can only be read once.";
+	else if (batch.outdir != NULL && CxIsStdio(batch.outdir)) stdioError = "-o - takes a single input file.";
+	else if (nStdin > 0 && batch.index) stdioError = "An index can't be written beside standard input.";
+	if (stdioError != NULL) {
+		fprintf(stderr, "%s\n", stdioError);
+		CxPathListFree(&batch.inputs);
+		return 1;
+	}
+	if (stats) batch.stats = toStdout ? stderr : stdout;
 
-	u8 *inbuf = malloc(size);
-	fread(inbuf, 1, size, fp);
-	fclose(fp);
-	
-	// Try to decompress the data.
-	u32 decompSize;
-	u8 *decomp = CxUncompressAsh(inbuf, size, &decompSize, nSymBits, nDistBits);
-	free(inbuf);
+	const unsigned int nProcessors = CxGetProcessorCount();
+	if (nThreads == 0) nThreads = nProcessors;
+	if (nThreads > batch.inputs.nPaths) nThreads = batch.inputs.nPaths;
 
-	// Set output file name (if one is not specified).
-	char strbuf[1024];
-	if (outpath == NULL) {
-		// If no output file is specified, append .arc to the input name.
-		sprintf(strbuf, "%s.arc", argv[1]);
-		outpath = strbuf;
+	// With processors to spare, give each file a second thread to decode its distances on.
+	batch.parallel = nThreads < nProcessors;
+	CxThreadPool *pool = CxThreadPoolCreate(nThreads);
+	batch.ctx = calloc(nThreads, sizeof(CxAshDecompressContext *));
+	batch.failed = calloc(batch.inputs.nPaths, 1);
+	batch.pipeline = CxPipelineCreate(batch.inputs.paths, batch.inputs.nPaths, nThreads);
+	int ok = pool != NULL && batch.ctx != NULL && batch.failed != NULL && batch.pipeline != NULL;
+	for (unsigned int i = 0; ok && i < nThreads; i++) {
+		batch.ctx[i] = CxAshDecompressContextCreate();
+		if (batch.ctx[i] == NULL) ok = 0;
 	}
-
-	// Open the output file for writing and ensure that it can be written to.
-	fp = fopen(outpath, "wb");
-	if (fp == NULL) {
-		fprintf(stderr, "Could not open %s for write access.\n", outpath);
+	if (!ok) {
+		fprintf(stderr, "Could not create worker threads.\n");
+		if (pool != NULL) CxThreadPoolDestroy(pool);
+		CxPipelineDestroy(batch.pipeline, NULL);
+		for (unsigned int i = 0; batch.ctx != NULL && i < nThreads; i++) CxAshDecompressContextDestroy(batch.ctx[i]);
+		free(batch.ctx);
+		free(batch.failed);
+		CxPathListFree(&batch.inputs);
 		return 1;
 	}
 
-	// Write decompressed data and close the file.
-	fwrite(decomp, 1, decompSize, fp);
-	free(decomp);
-	fclose(fp);
-	return 0;
+	CxThreadPoolRun(pool, batch.inputs.nPaths, DecompressJob, &batch);
+	CxPipelineDestroy(batch.pipeline, batch.failed);
+
+	int nFailed = 0;
+	for (unsigned int i = 0; i < batch.inputs.nPaths; i++) nFailed += batch.failed[i];
+	for (unsigned int i = 0; i < nThreads; i++) CxAshDecompressContextDestroy(batch.ctx[i]);
+	free(batch.ctx);
+	free(batch.failed);
+	CxThreadPoolDestroy(pool);
+	CxPathListFree(&batch.inputs);
+	return nFailed ? 1 : 0;
 }
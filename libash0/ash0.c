@@ -0,0 +1,20 @@
+/* ASH0-tools libash0 "ash0.c"
+ * Copyright (c) 2024 Garhoogin and NinjaCheetah
+ * This code is licensed under the MIT license. See LICENSE for more information.
+ *
+ * This file implements the parts of the library shared by compression and decompression.
+ */
+#include "ash0.h"
+
+const char *CxAshErrorString(int error) {
+	switch (error) {
+		case CX_ASH_OK:                return "Success.";
+		case CX_ASH_ERR_INVALID_PARAM: return "Invalid parameter.";
+		case CX_ASH_ERR_INVALID_DATA:  return "Invalid compressed data.";
+		case CX_ASH_ERR_BUFFER_SIZE:   return "Output buffer too small.";
+		case CX_ASH_ERR_NO_MEMORY:     return "Out of memory.";
+		case CX_ASH_ERR_TOO_LARGE:     return "File size exceeds maximum allowed size.";
+		case CX_ASH_ERR_READ:          return "Could not read the compressed data.";
+	}
+	return "Unknown error.";
+}
@@ -0,0 +1,240 @@
+/* ASH0-tools libash0 "ash0.h"
+ * Copyright (c) 2024 Garhoogin and NinjaCheetah
+ * This code is licensed under the MIT license. See LICENSE for more information.
+ *
+ * This file declares the library interface for compressing and decompressing Nintendo's ASH0 format used on the Wii.
+ */
+#ifndef ASH0_H
+#define ASH0_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Result codes returned by the library functions.
+#define CX_ASH_OK                0
+#define CX_ASH_ERR_INVALID_PARAM 1 // a parameter is out of range
+#define CX_ASH_ERR_INVALID_DATA  2 // the input is not valid ASH0 data
+#define CX_ASH_ERR_BUFFER_SIZE   3 // the output buffer is too small
+#define CX_ASH_ERR_NO_MEMORY     4
+#define CX_ASH_ERR_TOO_LARGE     5 // the input is too large to compress
+#define CX_ASH_ERR_READ          6 // a read callback failed
+
+// Extra bytes of output buffer that let every match be copied in whole blocks.
+#define CX_ASH_DECOMPRESS_PADDING 16
+
+// Limits on the tree widths. Files found on the Wii use 9 symbol bits and either 11 or 15 distance bits.
+#define CX_ASH_MIN_SYM_BITS  9
+#define CX_ASH_MIN_DIST_BITS 1
+#define CX_ASH_MAX_BITS      16
+
+// The header stores the uncompressed size in 24 bits.
+#define CX_ASH_MAX_SIZE      0xFFFFFF
+
+// Returns a description of a result code.
+const char *CxAshErrorString(int error);
+
+
+// ----- decompression
+
+// Decompression context. It owns the scratch memory used while decompressing, keeping it from one call to the
+// next, so a context reused for many files only allocates while its buffers grow. A context must not be used by
+// two threads at once.
+typedef struct CxAshDecompressContext_ CxAshDecompressContext;
+
+// Returns NULL if out of memory.
+CxAshDecompressContext *CxAshDecompressContextCreate(void);
+
+void CxAshDecompressContextDestroy(CxAshDecompressContext *ctx);
+
+// Describes the last file a context decompressed successfully.
+typedef struct CxAshDecompressInfo_ {
+	uint32_t nLiterals;         // symbols decoded, literals and matches
+	uint32_t nMatches;
+	uint32_t nCopyBytes;        // bytes copied by matches
+	uint64_t symStreamBits;     // bits consumed from the symbol stream, including its tree
+	uint64_t distStreamBits;    // bits consumed from the distance stream, including its tree
+} CxAshDecompressInfo;
+
+// CxAshDecompressParallel decodes distances ahead until the distance stream runs out, so its count of the bits of
+// that stream takes in the padding at the end.
+void CxAshDecompressGetInfo(const CxAshDecompressContext *ctx, CxAshDecompressInfo *info);
+
+// Reads the size of the data held by an ASH0 file from its header.
+int CxAshGetUncompressedSize(const void *src, size_t srcSize, uint32_t *pSize);
+
+// Decompresses an ASH0 file into dest, which must hold at least the number of bytes given by
+// CxAshGetUncompressedSize. The tree widths aren't stored in the file, so they must be known in advance.
+// Room in dest beyond the decompressed size is used as scratch by the match copies. With at least
+// CX_ASH_DECOMPRESS_PADDING bytes to spare, matches at the very end of the output take the fast path too.
+// Malformed input is reported as CX_ASH_ERR_INVALID_DATA, without reading outside src or writing outside dest, so
+// files from untrusted sources can be decompressed with it.
+int CxAshDecompress(CxAshDecompressContext *ctx, const void *src, size_t srcSize, void *dest, size_t destSize,
+	int symBits, int distBits);
+
+// Works out the tree widths of an ASH0 file, for files whose widths aren't known in advance. A width given as 0 is
+// detected, any other is taken as known. Each candidate tree is read on its own, then the pairs of widths that read
+// both trees are tested by decoding the first 16 KiB of output. If more than one pair gets through, they are told apart
+// by decoding the whole file without storing it. This can't prove the widths right, only rule out wrong ones. A file
+// with very few matches, or very narrow distances, can fit more than one pair, and then giving the width that is known
+// is safer. Returns CX_ASH_ERR_INVALID_DATA if no pair of widths fits.
+int CxAshDetectBits(CxAshDecompressContext *ctx, const void *src, size_t srcSize, int *pSymBits, int *pDistBits);
+
+// Files that decompress to fewer bytes than this aren't worth decompressing in parallel.
+#define CX_ASH_PARALLEL_MIN_SIZE 0x40000
+
+// Like CxAshDecompress, but decodes the distance stream on a second thread, ahead of the thread decoding
+// symbols and copying matches. Falls back to CxAshDecompress for small files, or where threads aren't supported.
+int CxAshDecompressParallel(CxAshDecompressContext *ctx, const void *src, size_t srcSize, void *dest, size_t destSize,
+	int symBits, int distBits);
+
+
+// ----- streaming decompression
+
+// Reads size bytes of compressed data starting at offset into buf. Returns the number of bytes read, anything
+// less than size being treated as an error.
+typedef size_t (*CxAshReadProc)(void *param, size_t offset, void *buf, size_t size);
+
+// Streaming decompressor, for producing the output a piece at a time. The symbols and distances of an ASH0 file
+// are stored in two separate streams that are read side by side, so input is taken through a callback that reads
+// at a given offset rather than in order. Memory use is fixed by the tree widths: besides the decoding tables, a
+// stream holds a small input buffer per stream and the last 1 << distBits bytes of output, which matches may
+// refer back to.
+typedef struct CxAshStream_ CxAshStream;
+
+// Returns NULL if out of memory.
+CxAshStream *CxAshStreamCreate(void);
+
+void CxAshStreamDestroy(CxAshStream *stream);
+
+// Starts decompressing srcSize bytes of compressed data read through proc. This reads the header and both trees.
+// A stream can be started again to decompress another file, reusing its memory.
+int CxAshStreamBegin(CxAshStream *stream, CxAshReadProc proc, void *param, size_t srcSize, int symBits, int distBits);
+
+// Size of the decompressed data of the file being decompressed.
+uint32_t CxAshStreamGetSize(const CxAshStream *stream);
+
+// Decompresses up to size bytes of output into dest, setting *pnWritten to the number written. This only falls
+// short of size at the end of the output. Once an error has been returned, every later call returns it too.
+int CxAshStreamRead(CxAshStream *stream, void *dest, size_t size, size_t *pnWritten);
+
+
+// ----- random access
+
+// An index of an ASH0 file lets part of its output be decoded without decoding everything before it. It is kept
+// beside the file, and holds a checkpoint for about every interval bytes of output: where each stream's reader
+// was then, and the last 1 << distBits bytes of output, which the matches after it may refer back to. The index
+// records the tree widths and the sizes of the file it was made for, and is only used with a file that has them.
+// All of its fields are big endian, like those of the file.
+
+// Output between checkpoints by default. With 15 distance bits, this gives an index of about an eighth of the size
+// of the output.
+#define CX_ASH_INDEX_INTERVAL 0x40000
+
+// Builds the index of a compressed file, given the data it decompresses to, which is checked against it as the
+// index is built. That data is at hand when a file is compressed, or once it has been decompressed in whole. An
+// interval of 0 means CX_ASH_INDEX_INTERVAL. On success *pIndex points to the index, which is held by the context
+// and stays valid until the context is next used or destroyed.
+int CxAshBuildIndex(CxAshDecompressContext *ctx, const void *src, size_t srcSize, const void *data, size_t dataSize,
+	int symBits, int distBits, uint32_t interval, const void **pIndex, size_t *pIndexSize);
+
+// Decompresses size bytes of output starting at offset into dest, decoding from the last checkpoint before offset.
+// Widths given as 0 are taken from the index, any other must match it. Without an index (NULL), decoding starts
+// from the beginning of the file, stopping at the end of the range, and both widths must be given. A range that
+// runs past the end of the output returns CX_ASH_ERR_INVALID_PARAM, as does an index that doesn't belong to the
+// file. Scratch memory grows with the bytes decoded from the checkpoint to the end of the range.
+int CxAshDecompressRange(CxAshDecompressContext *ctx, const void *src, size_t srcSize, const void *index,
+	size_t indexSize, int symBits, int distBits, uint32_t offset, void *dest, size_t size);
+
+
+// ----- compression
+
+typedef struct CxAshCompressParams_ {
+	int symBits;                // symbol tree width
+	int distBits;               // distance tree width
+	unsigned int nPasses;       // most optimizing passes after the first tokenization
+	unsigned int searchDepth;   // maximum match candidates visited per position, 0 for unlimited
+	unsigned int maxCodeLength; // if nonzero, use canonical codes of at most this many bits
+	unsigned int nThreads;      // threads to find matches on, counting the calling thread; 0 is the same as 1
+	unsigned int timeLimit;     // if nonzero, milliseconds after which no more optimizing passes are started
+	unsigned int fastLevel;     // if nonzero, a quicker first tokenization: CX_ASH_FAST_LAZY or CX_ASH_FAST_GREEDY
+	unsigned int splitBlocks;   // if nonzero, the first tokenization is done in blocks, which can go on the threads
+} CxAshCompressParams;
+
+// Fast levels, for when compressing quickly matters more than compressing well. The lazy parse searches at most 16
+// candidates per position, or the search depth if one is given, and takes a match a byte later when that one is
+// longer. The greedy parse looks up a single candidate per position in a small table and takes any match found.
+// Both give ordinary ASH0 files, and any optimizing passes still run after them.
+#define CX_ASH_FAST_LAZY   1
+#define CX_ASH_FAST_GREEDY 2
+
+// The optimizing passes stop early once one fails to make the output any smaller, and the smallest result is the
+// one kept. With a time limit, the first pass is started as long as the limit hasn't already been reached, and
+// each later one only if it is expected to finish within it, going by how long the one before took.
+
+// Upper limit on CxAshCompressParams.nThreads.
+#define CX_ASH_MAX_THREADS 256
+
+// Fills in the default parameters, which produce files readable by the System Menu.
+void CxAshCompressParamsInit(CxAshCompressParams *params);
+
+// Compression context, holding scratch memory like CxAshDecompressContext. A context compressing on several
+// threads keeps them, and their scratch memory, until it is destroyed.
+typedef struct CxAshCompressContext_ CxAshCompressContext;
+
+// Returns NULL if out of memory.
+CxAshCompressContext *CxAshCompressContextCreate(void);
+
+void CxAshCompressContextDestroy(CxAshCompressContext *ctx);
+
+// Compresses src. On success *pDest points to the compressed data, which is held by the context and stays valid
+// until the context is next used or destroyed.
+// Extra threads find matches for the optimizing passes, and the output is the same for any number of them. With
+// splitBlocks, the first tokenization of a large input is also done in separate blocks, each searching back into
+// the blocks before it, so it can share the threads too. The output can then differ slightly from an unsplit run,
+// but it is the same for any number of threads, including one.
+int CxAshCompress(CxAshCompressContext *ctx, const void *src, size_t srcSize, const CxAshCompressParams *params,
+	const void **pDest, size_t *pDestSize);
+
+// Picks the tree widths expected to compress src the smallest, for compressing it with afterwards. A width given as
+// 0 is chosen, any other is kept as it is. A single sweep of the match finder tokenizes the input at every distance
+// width at once, and the size of each pair of widths is estimated from the entropy of the symbols it would write,
+// with the matches too long for a symbol width split up. The estimates are those of the first tokenization, the
+// one compression level 0 stops at. Of params, only the search depth is used, and without one the sweep visits
+// at most 128 candidates per position. The sweep runs on the calling thread.
+int CxAshChooseBits(CxAshCompressContext *ctx, const void *src, size_t srcSize, const CxAshCompressParams *params,
+	int *pSymBits, int *pDistBits);
+
+// Number of passes CxAshCompressInfo records the output size of.
+#define CX_ASH_INFO_PASSES 32
+
+// Describes how the last successful call to CxAshCompress with a context went. Times are in microseconds of wall
+// time. Collecting these costs next to nothing, so it is always done.
+typedef struct CxAshCompressInfo_ {
+	unsigned int nPassesRun;    // optimizing passes run
+	unsigned int bestPass;      // pass whose output was kept, 0 for the first tokenization
+	uint32_t passSize[CX_ASH_INFO_PASSES]; // output size each pass would have given, from the first tokenization on
+
+	uint64_t tokenizeTime;      // the first tokenization
+	uint64_t chainTime;         // building the hash chains for the optimizing passes
+	uint64_t retokenizeTime;    // all optimizing passes, but for building their codes
+	uint64_t huffmanTime;       // building the codes, for every pass
+	uint64_t outputTime;        // writing the output
+	uint64_t tokenizeProbes;    // match candidates the first tokenization visited
+	uint64_t retokenizeProbes;  // match candidates the optimizing passes visited
+
+	uint32_t nLiterals;         // tokens of the output
+	uint32_t nMatches;
+	uint32_t nMatchBytes;       // bytes covered by matches
+} CxAshCompressInfo;
+
+void CxAshCompressGetInfo(const CxAshCompressContext *ctx, CxAshCompressInfo *info);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,1446 @@
+/* ASH0-tools libash0 "ash0dec.c"
+ * Copyright (c) 2024 Garhoogin and NinjaCheetah
+ * This code is licensed under the MIT license. See LICENSE for more information.
+ *
+ * This file implements the decompression routines for extracting Nintendo's ASH0 files used on the Wii.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "ash0.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CX_HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
+typedef uint64_t u64;
+typedef uint32_t u32;
+typedef uint16_t u16;
+typedef uint8_t u8;
+
+#define TREE_RIGHT    0x80000000
+#define TREE_LEFT     0x40000000
+#define TREE_VAL_MASK 0x3FFFFFFF
+
+// Forces a function to be inlined, so that each caller gets a copy specialized to its constant arguments.
+#if defined(_MSC_VER)
+#define CX_FORCE_INLINE __forceinline
+#else
+#define CX_FORCE_INLINE inline __attribute__((always_inline))
+#endif
+
+// Returns CX_ASH_ERR_INVALID_DATA from the calling function if a check on the compressed data fails.
+#define CX_CHECK_DATA(x)   if(!(x))return CX_ASH_ERR_INVALID_DATA
+
+// ASH0 data is big endian. Most systems this code will be run on will be little endian, so provide loads that
+// convert it with the compiler's byte swap intrinsics.
+#if defined(_MSC_VER)
+#define CxSwap32(x) _byteswap_ulong(x)
+#define CxSwap64(x) _byteswap_uint64(x)
+#else
+#define CxSwap32(x) __builtin_bswap32(x)
+#define CxSwap64(x) __builtin_bswap64(x)
+#endif
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define CxFromBig32(x) (x)
+#define CxFromBig64(x) (x)
+#else
+#define CxFromBig32(x) CxSwap32(x)
+#define CxFromBig64(x) CxSwap64(x)
+#endif
+
+static inline u32 CxRead32BE(const u8 *p) {
+	u32 v;
+	memcpy(&v, p, sizeof(v));
+	return CxFromBig32(v);
+}
+
+static inline u64 CxRead64BE(const u8 *p) {
+	u64 v;
+	memcpy(&v, p, sizeof(v));
+	return CxFromBig64(v);
+}
+
+
+// Bit reader holding up to 64 bits at a time, so that a table decoder can look ahead at the next code without
+// consuming it. The next bit is kept in the most significant position of the buffer.
+typedef struct CxBitReader_ {
+	const u8 *srcp;
+	const u8 *endp;
+	u64 bits;
+	int nBits; // number of valid bits buffered, negative once the reader has been read past the end
+	struct CxAshSource_ *source; // when streaming, where to read more data from once srcp reaches endp
+} CxBitReader;
+
+// Input of a streaming decoder, each stream reading through its own buffer.
+#define CX_ASH_SOURCE_BUFFER 4096
+
+typedef struct CxAshSource_ {
+	CxAshReadProc proc;
+	void *param;
+	size_t offset;    // position in the compressed data the buffer continues from
+	size_t end;       // end of the compressed data
+	int error;        // set once a read fails
+	u8 buffer[CX_ASH_SOURCE_BUFFER];
+} CxAshSource;
+
+// Moves the bytes left in the buffer to its start and fills the rest from the source.
+static void CxAshSourceFill(CxBitReader *reader) {
+	CxAshSource *source = reader->source;
+	const size_t nKeep = reader->endp - reader->srcp;
+	memmove(source->buffer, reader->srcp, nKeep);
+
+	size_t nRead = sizeof(source->buffer) - nKeep;
+	if (nRead > source->end - source->offset) nRead = source->end - source->offset;
+	const size_t nGot = source->proc(source->param, source->offset, source->buffer + nKeep, nRead);
+	if (nGot != nRead) {
+		// A failed read leaves the stream looking truncated, the error is reported at the next check.
+		source->error = 1;
+		source->end = source->offset;
+		nRead = 0;
+	}
+	source->offset += nRead;
+
+	reader->srcp = source->buffer;
+	reader->endp = source->buffer + nKeep + nRead;
+}
+
+static void CxBitReaderRefillTail(CxBitReader *reader) {
+	if (reader->source != NULL && reader->source->offset < reader->source->end) {
+		CxAshSourceFill(reader);
+		if (reader->endp - reader->srcp >= 8) {
+			reader->bits |= CxRead64BE(reader->srcp) >> reader->nBits;
+			reader->srcp += (63 - reader->nBits) >> 3;
+			reader->nBits |= 56;
+			return;
+		}
+	}
+
+	// Bits past the end of the data read as zero, consuming them is caught by checking nBits afterwards.
+	while (reader->srcp < reader->endp && reader->nBits <= 56) {
+		reader->bits |= (u64) *(reader->srcp++) << (56 - reader->nBits);
+		reader->nBits += 8;
+	}
+}
+
+// Tops the buffer up to 56 bits or more, for a caller that has made sure at least 8 bytes are left to load. Each
+// refill advances the reader by the whole bytes that fit, so it is never more than 8 bytes ahead of the bits
+// consumed.
+static CX_FORCE_INLINE void CxBitReaderRefillFast(CxBitReader *reader) {
+	// Bits loaded beyond the whole bytes are loaded again at the same position by the next refill, so leaving
+	// them in the buffer does no harm.
+	reader->bits |= CxRead64BE(reader->srcp) >> reader->nBits;
+	reader->srcp += (63 - reader->nBits) >> 3;
+	reader->nBits |= 56;
+}
+
+// Tops the buffer up to at least 56 bits, or as many as remain in the source.
+static inline void CxBitReaderRefill(CxBitReader *reader) {
+	if (reader->endp - reader->srcp >= 8) {
+		CxBitReaderRefillFast(reader);
+	} else {
+		CxBitReaderRefillTail(reader);
+	}
+}
+
+static inline u32 CxBitReaderPeek(const CxBitReader *reader, const int nBits) {
+	return (u32) (reader->bits >> (64 - nBits));
+}
+
+static inline void CxBitReaderConsume(CxBitReader *reader, const int nBits) {
+	reader->bits <<= nBits;
+	reader->nBits -= nBits;
+}
+
+// The caller makes sure startpos is within the data.
+static void CxBitReaderInit(CxBitReader *reader, const u8 *src, u32 size, u32 startpos) {
+	reader->srcp = src + startpos;
+	reader->endp = src + size;
+	reader->bits = 0;
+	reader->nBits = 0;
+	reader->source = NULL;
+}
+
+// Starts a reader on a stream beginning at offset in the compressed data. The buffer is filled by the first refill.
+static void CxBitReaderInitSource(CxBitReader *reader, CxAshSource *source, CxAshReadProc proc, void *param,
+	size_t offset, size_t end) {
+	source->proc = proc;
+	source->param = param;
+	source->offset = offset;
+	source->end = end;
+	source->error = 0;
+
+	reader->srcp = source->buffer;
+	reader->endp = source->buffer;
+	reader->bits = 0;
+	reader->nBits = 0;
+	reader->source = source;
+}
+
+
+// A tree is held as an array of its branches, numbered in the order they appear in the stream, which is also the
+// order the decoding tables are built in. Each branch has its two children side by side. Nodes are referred to by
+// a value below nLeaves for a leaf, being its symbol, or nLeaves plus the index of a branch.
+typedef struct CxHuffTree_ {
+	u32 *children;  // left and right child of each branch
+	u32 nLeaves;
+	u32 root;
+	u32 maxDepth;   // depth of the deepest leaf, the length of the longest code
+} CxHuffTree;
+
+// Words of memory needed by a tree of the given width, for CxHuffTreeInit.
+static u32 CxHuffTreeSize(int width) {
+	return 2 * ((1 << width) - 1);
+}
+
+static void CxHuffTreeInit(CxHuffTree *tree, int width, u32 *mem) {
+	tree->nLeaves = 1 << width;
+	tree->children = mem;
+	tree->root = 0;
+	tree->maxDepth = 0;
+}
+
+static inline u32 CxHuffTreeChild(const CxHuffTree *tree, u32 node, int side) {
+	return tree->children[2 * (node - tree->nLeaves) + side];
+}
+
+// Reads a tree from the stream. work must have room for 2 << width entries. Every node read is checked to fit in
+// the tree, so a tree read successfully is whole and has no more than nLeaves leaves.
+static int CxAshReadTree(CxBitReader *reader, CxHuffTree *tree, int width, u32 *work) {
+	const u32 nLeaves = tree->nLeaves;
+	u32 nBranches = 0;
+	u32 node = 0;
+	u32 nNodes = 0;
+	u32 depth = 0;     // of the next node read, each branch above it having its right child waiting on the stack
+	u32 maxDepth = 0;
+	do {
+		// One refill covers the branch bit and the symbol of a leaf.
+		CxBitReaderRefill(reader);
+		const int isBranch = CxBitReaderPeek(reader, 1);
+		CxBitReaderConsume(reader, 1);
+		if (isBranch) {
+			// A tree of n leaves only has n - 1 branches.
+			CX_CHECK_DATA(nBranches < nLeaves - 1);
+			*work++ = nBranches | TREE_RIGHT;
+			*work++ = nBranches | TREE_LEFT;
+			nNodes += 2;
+			nBranches++;
+			depth++;
+		} else {
+			node = CxBitReaderPeek(reader, width);
+			CxBitReaderConsume(reader, width);
+			if (depth > maxDepth) maxDepth = depth;
+			while (nNodes > 0) {
+				const u32 nodeval = *--work;
+				const u32 idx = nodeval & TREE_VAL_MASK;
+				nNodes--;
+				if (nodeval & TREE_RIGHT) {
+					tree->children[2 * idx + 1] = node;
+					node = nLeaves + idx;
+					depth--;
+				} else {
+					tree->children[2 * idx + 0] = node;
+					break;
+				}
+			}
+		}
+	} while (nNodes > 0);
+
+	CX_CHECK_DATA(reader->nBits >= 0);
+
+	tree->root = node;
+	tree->maxDepth = maxDepth;
+	return CX_ASH_OK;
+}
+
+
+// Huffman codes are decoded with a primary table indexed by the next CX_HUFF_TABLE_BITS bits of the stream. Codes
+// too long for it continue in smaller subtables. Each entry holds a value in its upper 24 bits and the number of
+// bits it spans in its low 7 bits. For CX_HUFF_LINK entries, the value is the offset of the subtable to continue in.
+#define CX_HUFF_TABLE_BITS    11
+#define CX_HUFF_SUBTABLE_BITS 7
+#define CX_HUFF_LINK          0x80
+
+typedef struct CxHuffTable_ {
+	u32 *entries;
+	u32 nEntries;
+	u32 nAlloc;
+	int bits;     // index width of the primary table
+	u32 maxBits;  // length of the longest code, the most bits a symbol can consume
+} CxHuffTable;
+
+// Depth of the subtree under node, up to a maximum of limit.
+static int CxHuffTreeDepth(const CxHuffTree *tree, u32 node, int limit) {
+	if (node < tree->nLeaves || limit == 0) return 0;
+
+	int left = CxHuffTreeDepth(tree, CxHuffTreeChild(tree, node, 0), limit - 1);
+	int right = CxHuffTreeDepth(tree, CxHuffTreeChild(tree, node, 1), limit - 1);
+	return 1 + (left > right ? left : right);
+}
+
+// Reserves 1 << bits entries, returning their offset, or UINT32_MAX if out of memory.
+static u32 CxHuffTableAlloc(CxHuffTable *table, int bits) {
+	const u32 offset = table->nEntries;
+	const u32 nEntries = 1 << bits;
+	if (offset + nEntries > table->nAlloc) {
+		u32 nAlloc = table->nAlloc;
+		while (offset + nEntries > nAlloc) nAlloc *= 2;
+		u32 *entries = realloc(table->entries, nAlloc * sizeof(u32));
+		if (entries == NULL) return UINT32_MAX;
+		table->entries = entries;
+		table->nAlloc = nAlloc;
+	}
+	table->nEntries += nEntries;
+	return offset;
+}
+
+// Fills the entries of one table level reached through the subtree under node. Nodes still internal at the
+// depth of the table are queued so their own subtables can be built afterwards.
+static void CxHuffTableFill(CxHuffTable *table, u32 offset, int bits, const CxHuffTree *tree, u32 node, int depth,
+                            u32 code, u32 *queue, u32 *nQueued) {
+	if (node < tree->nLeaves) {
+		const u32 entry = (node << 8) | depth;
+		const u32 first = code << (bits - depth);
+		for (u32 i = 0; i < (1u << (bits - depth)); i++) table->entries[offset + first + i] = entry;
+	} else if (depth == bits) {
+		queue[(*nQueued)++] = offset + code;
+		queue[(*nQueued)++] = node;
+	} else {
+		CxHuffTableFill(table, offset, bits, tree, CxHuffTreeChild(tree, node, 0), depth + 1, (code << 1) | 0, queue, nQueued);
+		CxHuffTableFill(table, offset, bits, tree, CxHuffTreeChild(tree, node, 1), depth + 1, (code << 1) | 1, queue, nQueued);
+	}
+}
+
+// Builds the decoding table for a tree. The table's entries are kept allocated across builds, so a zeroed table
+// can be built any number of times before freeing it. queue must have room for 2 << width entries.
+static int CxHuffTableBuild(CxHuffTable *table, const CxHuffTree *tree, u32 *queue) {
+	// Each queued subtable takes two words: the entry to link it from, then the node it starts at.
+	u32 nQueued = 0;
+
+	if (table->entries == NULL) {
+		table->nAlloc = 1 << CX_HUFF_TABLE_BITS;
+		table->entries = malloc(table->nAlloc * sizeof(u32));
+		if (table->entries == NULL) return CX_ASH_ERR_NO_MEMORY;
+	}
+	table->nEntries = 0;
+
+	// A tree consisting of only its root still needs a one-bit table, those codes just consume no bits.
+	int bits = CxHuffTreeDepth(tree, tree->root, CX_HUFF_TABLE_BITS);
+	if (bits == 0) bits = 1;
+	table->bits = bits;
+	table->maxBits = tree->maxDepth;
+	u32 offset = CxHuffTableAlloc(table, bits);
+	if (offset == UINT32_MAX) return CX_ASH_ERR_NO_MEMORY;
+	CxHuffTableFill(table, offset, bits, tree, tree->root, 0, 0, queue, &nQueued);
+
+	while (nQueued > 0) {
+		const u32 node = queue[--nQueued];
+		const u32 link = queue[--nQueued];
+		const int subBits = CxHuffTreeDepth(tree, node, CX_HUFF_SUBTABLE_BITS);
+		offset = CxHuffTableAlloc(table, subBits);
+		if (offset == UINT32_MAX) return CX_ASH_ERR_NO_MEMORY;
+
+		table->entries[link] = (offset << 8) | CX_HUFF_LINK | subBits;
+		CxHuffTableFill(table, offset, subBits, tree, node, 0, 0, queue, &nQueued);
+	}
+	return CX_ASH_OK;
+}
+
+static void CxHuffTableFree(CxHuffTable *table) {
+	free(table->entries);
+	table->entries = NULL;
+}
+
+// Decodes a symbol, starting from a primary table bits wide. With fast set, the reader refills without checking
+// for the end of its data, which the caller makes sure is far enough away for the longest code.
+static CX_FORCE_INLINE u32 CxHuffTableDecodeBits(const CxHuffTable *table, CxBitReader *reader, int bits, int fast) {
+	u32 entry = table->entries[CxBitReaderPeek(reader, bits)];
+	while (entry & CX_HUFF_LINK) {
+		CxBitReaderConsume(reader, bits);
+		if (fast) CxBitReaderRefillFast(reader);
+		else CxBitReaderRefill(reader);
+		bits = entry & 0x7F;
+		entry = table->entries[(entry >> 8) + CxBitReaderPeek(reader, bits)];
+	}
+	CxBitReaderConsume(reader, entry & 0x7F);
+	return entry >> 8;
+}
+
+static inline u32 CxHuffTableDecode(const CxHuffTable *table, CxBitReader *reader) {
+	return CxHuffTableDecodeBits(table, reader, table->bits, 0);
+}
+
+
+// Match copies run in blocks that may write past the end of the match by up to CX_ASH_DECOMPRESS_PADDING bytes.
+// Those bytes belong to output not yet produced, so they are overwritten before anything reads them. Matches
+// within that distance of the end of the buffer are copied a byte at a time instead.
+static inline void CxAshCopyMatchFast(u8 *destp, u32 dist, u32 len) {
+	const u8 *srcp = destp - dist;
+	u8 *endp = destp + len;
+
+	if (dist >= 16) {
+		do {
+			memcpy(destp, srcp, 16);
+			destp += 16;
+			srcp += 16;
+		} while (destp < endp);
+	} else if (dist >= 8) {
+		// Each block only reads bytes written before it.
+		do {
+			memcpy(destp, srcp, 8);
+			destp += 8;
+			srcp += 8;
+		} while (destp < endp);
+	} else {
+		// The match repeats the last dist bytes. Lay the pattern out over 8 bytes, then store it repeatedly,
+		// stepping by the largest multiple of dist that fits so the pattern stays in phase.
+		u8 pattern[8];
+		for (u32 i = 0; i < 8; i++) pattern[i] = srcp[i % dist];
+		const u32 step = 8 - (8 % dist);
+		do {
+			memcpy(destp, pattern, 8);
+			destp += step;
+		} while (destp < endp);
+	}
+}
+
+static inline void CxAshCopyMatch(u8 *destp, const u8 *bufEnd, u32 dist, u32 len) {
+	if ((size_t) (bufEnd - destp) >= (size_t) len + CX_ASH_DECOMPRESS_PADDING) {
+		CxAshCopyMatchFast(destp, dist, len);
+	} else {
+		const u8 *srcp = destp - dist;
+		while (len--) *(destp++) = *(srcp++);
+	}
+}
+
+
+// Scratch memory for decompression. It is kept between calls, so that decompressing a batch of files doesn't
+// allocate it again for each one.
+struct CxAshDecompressContext_ {
+	u32 *trees;      // both trees, as laid out by CxHuffTreeInit
+	u32 treesSize;   // in words
+	u32 *work;       // node stack for CxAshReadTree, then the subtable queue for CxHuffTableBuild
+	u32 workSize;
+	CxHuffTable symTable;
+	CxHuffTable distTable;
+	u16 *distQueue;  // distances decoded ahead by CxAshDecompressParallel
+	u32 distQueueSize;
+	u8 *index;       // last index built by CxAshBuildIndex
+	size_t indexSize;
+	u8 *rangeBuf;    // window and output decoded by CxAshDecompressRange
+	size_t rangeBufSize;
+	CxAshDecompressInfo info;
+};
+
+CxAshDecompressContext *CxAshDecompressContextCreate(void) {
+	return calloc(1, sizeof(CxAshDecompressContext));
+}
+
+void CxAshDecompressContextDestroy(CxAshDecompressContext *ctx) {
+	if (ctx == NULL) return;
+	free(ctx->trees);
+	free(ctx->work);
+	CxHuffTableFree(&ctx->symTable);
+	CxHuffTableFree(&ctx->distTable);
+	free(ctx->distQueue);
+	free(ctx->index);
+	free(ctx->rangeBuf);
+	free(ctx);
+}
+
+void CxAshDecompressGetInfo(const CxAshDecompressContext *ctx, CxAshDecompressInfo *info) {
+	*info = ctx->info;
+}
+
+// Number of bits a reader has consumed since it started at start. Bytes are only counted as read once they are
+// loaded, and the bits loaded but not consumed are those buffered.
+static u64 CxBitReaderConsumed(const CxBitReader *reader, const u8 *start) {
+	return (u64) (reader->srcp - start) * 8 - reader->nBits;
+}
+
+// Records the counts of a file just decompressed.
+static void CxAshSetInfo(CxAshDecompressContext *ctx, u32 size, u32 nMatches, u32 nCopyBytes, u64 symStreamBits,
+	u64 distStreamBits) {
+	ctx->info.nLiterals = size - nCopyBytes;
+	ctx->info.nMatches = nMatches;
+	ctx->info.nCopyBytes = nCopyBytes;
+	ctx->info.symStreamBits = symStreamBits;
+	ctx->info.distStreamBits = distStreamBits;
+}
+
+static u32 *CxAshReserve(u32 **buf, u32 *size, u32 needed) {
+	if (*size < needed) {
+		u32 *newBuf = realloc(*buf, needed * sizeof(u32));
+		if (newBuf == NULL) return NULL;
+		*buf = newBuf;
+		*size = needed;
+	}
+	return *buf;
+}
+
+int CxAshGetUncompressedSize(const void *src, size_t srcSize, uint32_t *pSize) {
+	const u8 *inbuf = (const u8 *) src;
+	if (srcSize < 0xC || memcmp(inbuf, "ASH0", 4) != 0) return CX_ASH_ERR_INVALID_DATA;
+
+	*pSize = CxRead32BE(inbuf + 4) & 0x00FFFFFF;
+	return CX_ASH_OK;
+}
+
+static int CxAshCheckBits(int symBits, int distBits) {
+	if (symBits < CX_ASH_MIN_SYM_BITS || symBits > CX_ASH_MAX_BITS) return CX_ASH_ERR_INVALID_PARAM;
+	if (distBits < CX_ASH_MIN_DIST_BITS || distBits > CX_ASH_MAX_BITS) return CX_ASH_ERR_INVALID_PARAM;
+	return CX_ASH_OK;
+}
+
+// Reads the trees at the start of both streams and builds the context's decoding tables from them.
+static int CxAshReadTables(CxAshDecompressContext *ctx, CxBitReader *symReader, CxBitReader *distReader, int symBits,
+	int distBits) {
+	int result;
+	const u32 symMax = (1 << symBits);
+	const u32 distMax = (1 << distBits);
+
+	const u32 maxNodes = 2 * (symMax > distMax ? symMax : distMax);
+	const u32 symTreeSize = CxHuffTreeSize(symBits);
+	u32 *trees = CxAshReserve(&ctx->trees, &ctx->treesSize, symTreeSize + CxHuffTreeSize(distBits));
+	u32 *work = CxAshReserve(&ctx->work, &ctx->workSize, maxNodes);
+	if (trees == NULL || work == NULL) return CX_ASH_ERR_NO_MEMORY;
+
+	CxHuffTree symTree, distTree;
+	CxHuffTreeInit(&symTree, symBits, trees);
+	CxHuffTreeInit(&distTree, distBits, trees + symTreeSize);
+	if ((result = CxAshReadTree(symReader, &symTree, symBits, work)) != CX_ASH_OK) return result;
+	if ((result = CxAshReadTree(distReader, &distTree, distBits, work)) != CX_ASH_OK) return result;
+
+	// The trees are only needed to build the decoding tables.
+	if ((result = CxHuffTableBuild(&ctx->symTable, &symTree, work)) != CX_ASH_OK) return result;
+	return CxHuffTableBuild(&ctx->distTable, &distTree, work);
+}
+
+// Symbols decoded between checks in the fastest stretch of the output.
+#define CX_ASH_FAST_BATCH 16
+
+// Input a reader can need beyond the bits it will consume: it is up to 8 bytes ahead of them, and each refill
+// loads 8 bytes from there.
+#define CX_ASH_REFILL_SLACK 24
+
+// Decodes the symbols from destp up to stop, checking each match against the output around it. A match may run
+// past stop, but not past the end of the output.
+static CX_FORCE_INLINE int CxAshDecodeChecked(const CxHuffTable *symTable, const CxHuffTable *distTable,
+	CxBitReader *reader2, CxBitReader *reader, u8 *outbuf, const u8 *bufEnd, u8 **pDestp, const u8 *stop,
+	const u8 *endp, int tableBits, u32 *pnMatches, u32 *pnCopyBytes) {
+	u8 *destp = *pDestp;
+	u32 nMatches = *pnMatches, nCopyBytes = *pnCopyBytes;
+	while (destp < stop) {
+		CxBitReaderRefill(reader2);
+		const u32 sym = CxHuffTableDecodeBits(symTable, reader2, tableBits ? tableBits : symTable->bits, 0);
+
+		if (sym < 0x100) {
+			*(destp++) = sym;
+		} else {
+			CxBitReaderRefill(reader);
+			const u32 distsym = CxHuffTableDecodeBits(distTable, reader, tableBits ? tableBits : distTable->bits, 0);
+
+			const u32 copylen = (sym - 0x100) + 3;
+			CX_CHECK_DATA(copylen <= (u32) (endp - destp));   //check length valid
+			CX_CHECK_DATA((destp - outbuf) >= (distsym + 1)); //check source valid
+
+			CxAshCopyMatch(destp, bufEnd, distsym + 1, copylen);
+			destp += copylen;
+			nMatches++;
+			nCopyBytes += copylen;
+		}
+	}
+	*pDestp = destp;
+	*pnMatches = nMatches;
+	*pnCopyBytes = nCopyBytes;
+	return CX_ASH_OK;
+}
+
+// Main decompression loop, with the checks on each match taken out of the stretch of output where they can't fail.
+// Once the output is as long as the longest distance, every match has its source. While a match of the longest
+// length still fits before the end of the output, with room to copy it in blocks, every match fits too. Most of
+// that stretch is decoded in batches of CX_ASH_FAST_BATCH symbols, which check nothing at all: a batch starts only
+// while that many of the longest matches fit, and both readers have data left for that many of the longest codes
+// of their trees. The rest is decoded with every check. A tableBits of 0 takes the widths of the primary tables
+// from them, else they must be that wide. Sets *pnMatches to the number of matches, and *pnCopyBytes to the bytes
+// they copied.
+static CX_FORCE_INLINE int CxAshDecodeLoop(const CxHuffTable *symTable, const CxHuffTable *distTable,
+	CxBitReader *reader2, CxBitReader *reader, u8 *outbuf, size_t outbufSize, u32 uncompSize, int symBits,
+	int distBits, int tableBits, u32 *pnMatches, u32 *pnCopyBytes) {
+	int result;
+	u8 *destp = outbuf;
+	const u8 *bufEnd = outbuf + outbufSize;
+	const u8 *endp = outbuf + uncompSize;
+	u32 nMatches = 0, nCopyBytes = 0;
+
+	const u32 maxDist = 1u << distBits;
+	const size_t maxLen = (1u << symBits) - 0x100 + 2;
+	const size_t maxCopy = maxLen + CX_ASH_DECOMPRESS_PADDING;
+	const u8 *fastBegin = outbuf + (maxDist < uncompSize ? maxDist : uncompSize);
+	const u8 *fastEnd = outbuf + (uncompSize > maxCopy ? uncompSize - maxCopy : 0);
+	if (fastEnd < fastBegin) fastEnd = fastBegin;
+
+	const size_t batchLen = CX_ASH_FAST_BATCH * maxLen;
+	const u8 *batchEnd = ((size_t) (fastEnd - fastBegin) > batchLen) ? fastEnd - batchLen : fastBegin;
+	const size_t symMargin = CX_ASH_FAST_BATCH * (size_t) symTable->maxBits / 8 + CX_ASH_REFILL_SLACK;
+	const size_t distMargin = CX_ASH_FAST_BATCH * (size_t) distTable->maxBits / 8 + CX_ASH_REFILL_SLACK;
+
+	result = CxAshDecodeChecked(symTable, distTable, reader2, reader, outbuf, bufEnd, &destp, fastBegin, endp,
+		tableBits, &nMatches, &nCopyBytes);
+	if (result != CX_ASH_OK) return result;
+
+	while (destp < batchEnd && (size_t) (reader2->endp - reader2->srcp) >= symMargin
+		&& (size_t) (reader->endp - reader->srcp) >= distMargin) {
+		for (int i = 0; i < CX_ASH_FAST_BATCH; i++) {
+			CxBitReaderRefillFast(reader2);
+			const u32 sym = CxHuffTableDecodeBits(symTable, reader2, tableBits ? tableBits : symTable->bits, 1);
+
+			if (sym < 0x100) {
+				*(destp++) = sym;
+			} else {
+				CxBitReaderRefillFast(reader);
+				const u32 distsym = CxHuffTableDecodeBits(distTable, reader, tableBits ? tableBits : distTable->bits, 1);
+				const u32 copylen = (sym - 0x100) + 3;
+				CxAshCopyMatchFast(destp, distsym + 1, copylen);
+				destp += copylen;
+				nMatches++;
+				nCopyBytes += copylen;
+			}
+		}
+	}
+
+	while (destp < fastEnd) {
+		CxBitReaderRefill(reader2);
+		const u32 sym = CxHuffTableDecodeBits(symTable, reader2, tableBits ? tableBits : symTable->bits, 0);
+
+		if (sym < 0x100) {
+			*(destp++) = sym;
+		} else {
+			CxBitReaderRefill(reader);
+			const u32 distsym = CxHuffTableDecodeBits(distTable, reader, tableBits ? tableBits : distTable->bits, 0);
+			const u32 copylen = (sym - 0x100) + 3;
+			CxAshCopyMatchFast(destp, distsym + 1, copylen);
+			destp += copylen;
+			nMatches++;
+			nCopyBytes += copylen;
+		}
+	}
+
+	result = CxAshDecodeChecked(symTable, distTable, reader2, reader, outbuf, bufEnd, &destp, endp, endp, tableBits,
+		&nMatches, &nCopyBytes);
+	if (result != CX_ASH_OK) return result;
+
+	*pnMatches = nMatches;
+	*pnCopyBytes = nCopyBytes;
+	return CX_ASH_OK;
+}
+
+// Copies of the loop for the widths found on the Wii, with every width fixed. The primary tables of these must be
+// CX_HUFF_TABLE_BITS wide.
+static int CxAshDecode_9_11(const CxHuffTable *symTable, const CxHuffTable *distTable, CxBitReader *reader2,
+	CxBitReader *reader, u8 *outbuf, size_t outbufSize, u32 uncompSize, u32 *pnMatches, u32 *pnCopyBytes) {
+	return CxAshDecodeLoop(symTable, distTable, reader2, reader, outbuf, outbufSize, uncompSize, 9, 11,
+		CX_HUFF_TABLE_BITS, pnMatches, pnCopyBytes);
+}
+
+static int CxAshDecode_9_15(const CxHuffTable *symTable, const CxHuffTable *distTable, CxBitReader *reader2,
+	CxBitReader *reader, u8 *outbuf, size_t outbufSize, u32 uncompSize, u32 *pnMatches, u32 *pnCopyBytes) {
+	return CxAshDecodeLoop(symTable, distTable, reader2, reader, outbuf, outbufSize, uncompSize, 9, 15,
+		CX_HUFF_TABLE_BITS, pnMatches, pnCopyBytes);
+}
+
+static int CxAshDecodeAny(const CxHuffTable *symTable, const CxHuffTable *distTable, CxBitReader *reader2,
+	CxBitReader *reader, u8 *outbuf, size_t outbufSize, u32 uncompSize, int symBits, int distBits, u32 *pnMatches,
+	u32 *pnCopyBytes) {
+	return CxAshDecodeLoop(symTable, distTable, reader2, reader, outbuf, outbufSize, uncompSize, symBits, distBits, 0,
+		pnMatches, pnCopyBytes);
+}
+
+int CxAshDecompress(CxAshDecompressContext *ctx, const void *src, size_t srcSize, void *dest, size_t destSize,
+	int symBits, int distBits) {
+	const u8 *inbuf = (const u8 *) src;
+	u8 *outbuf = (u8 *) dest;
+	int result;
+
+	if ((result = CxAshCheckBits(symBits, distBits)) != CX_ASH_OK) return result;
+	if (srcSize > UINT32_MAX) return CX_ASH_ERR_INVALID_DATA;
+	const u32 size = (u32) srcSize;
+
+	u32 uncompSize;
+	if ((result = CxAshGetUncompressedSize(inbuf, size, &uncompSize)) != CX_ASH_OK) return result;
+	if (destSize < uncompSize) return CX_ASH_ERR_BUFFER_SIZE;
+
+	const u32 distOffset = CxRead32BE(inbuf + 0x8);
+	CX_CHECK_DATA(distOffset >= 0xC && distOffset <= size);
+
+	CxBitReader reader, reader2;
+	CxBitReaderInit(&reader, inbuf, size, distOffset);
+	CxBitReaderInit(&reader2, inbuf, size, 0xC);
+
+	if ((result = CxAshReadTables(ctx, &reader2, &reader, symBits, distBits)) != CX_ASH_OK) return result;
+	const CxHuffTable *symTable = &ctx->symTable, *distTable = &ctx->distTable;
+
+	// The files found on the Wii get decoding loops of their own, built for their widths. Tables with a primary
+	// table narrower than usual, from trees too shallow to fill it, take the general loop.
+	u32 nMatches = 0, nCopyBytes = 0;
+	const int fullTables = symTable->bits == CX_HUFF_TABLE_BITS && distTable->bits == CX_HUFF_TABLE_BITS;
+	if (fullTables && symBits == 9 && distBits == 11) {
+		result = CxAshDecode_9_11(symTable, distTable, &reader2, &reader, outbuf, destSize, uncompSize, &nMatches, &nCopyBytes);
+	} else if (fullTables && symBits == 9 && distBits == 15) {
+		result = CxAshDecode_9_15(symTable, distTable, &reader2, &reader, outbuf, destSize, uncompSize, &nMatches, &nCopyBytes);
+	} else {
+		result = CxAshDecodeAny(symTable, distTable, &reader2, &reader, outbuf, destSize, uncompSize, symBits, distBits,
+			&nMatches, &nCopyBytes);
+	}
+	if (result != CX_ASH_OK) return result;
+
+	// Make sure neither stream ran out before the output was complete.
+	CX_CHECK_DATA(reader2.nBits >= 0 && reader.nBits >= 0);
+	CxAshSetInfo(ctx, uncompSize, nMatches, nCopyBytes, CxBitReaderConsumed(&reader2, inbuf + 0xC),
+		CxBitReaderConsumed(&reader, inbuf + distOffset));
+	return CX_ASH_OK;
+}
+
+// Output decoded from the start of a file to test a pair of tree widths against before decoding all of it.
+#define CX_ASH_DETECT_PREFIX 0x4000
+
+// Reads one tree for CxAshDetectBits, checking that it ends before offset end and that no symbol is a leaf twice,
+// which a tree read at the wrong width almost always breaks.
+static int CxAshProbeTree(CxAshDecompressContext *ctx, const u8 *inbuf, u32 start, u32 end, int width) {
+	int result;
+	u32 *trees = CxAshReserve(&ctx->trees, &ctx->treesSize, CxHuffTreeSize(width));
+	u32 *work = CxAshReserve(&ctx->work, &ctx->workSize, 2 << width);
+	if (trees == NULL || work == NULL) return CX_ASH_ERR_NO_MEMORY;
+
+	CxBitReader reader;
+	CxHuffTree tree;
+	CxBitReaderInit(&reader, inbuf, end, start);
+	CxHuffTreeInit(&tree, width, trees);
+	if ((result = CxAshReadTree(&reader, &tree, width, work)) != CX_ASH_OK) return result;
+
+	if (tree.root < tree.nLeaves) return CX_ASH_OK;
+
+	// Branches are numbered in preorder, so the children of each are numbered after it and a single pass over
+	// them reaches every leaf.
+	u32 seen[(1 << CX_ASH_MAX_BITS) / 32];
+	memset(seen, 0, ((tree.nLeaves + 31) / 32) * sizeof(u32));
+	u32 nBranches = 1;
+	for (u32 i = 0; i < nBranches; i++) {
+		for (int side = 0; side < 2; side++) {
+			const u32 node = tree.children[2 * i + side];
+			if (node >= tree.nLeaves) {
+				if (node - tree.nLeaves >= nBranches) nBranches = node - tree.nLeaves + 1;
+			} else {
+				CX_CHECK_DATA(!(seen[node / 32] & (1u << (node % 32))));
+				seen[node / 32] |= 1u << (node % 32);
+			}
+		}
+	}
+	return CX_ASH_OK;
+}
+
+// Whether the bits of a stream from bit offset pos up to its end are all zero.
+static int CxAshPaddingIsZero(const u8 *stream, u64 pos, u64 end) {
+	if (pos % 8 && (stream[pos / 8] & (0xFF >> (pos % 8)))) return 0;
+	for (u64 i = (pos + 7) / 8; i < end / 8; i++) {
+		if (stream[i]) return 0;
+	}
+	return 1;
+}
+
+// Decodes the first limit bytes of a file with the given widths without storing the output, checking each match
+// against the output before it. Once the whole output is decoded, *pTight is set if each stream ends as our own
+// encoder ends them, in zeroes padding it to a whole word.
+static int CxAshProbeStreams(CxAshDecompressContext *ctx, const u8 *inbuf, u32 size, u32 distOffset, u32 uncompSize,
+	int symBits, int distBits, u32 limit, int *pTight) {
+	int result;
+	CxBitReader reader, reader2;
+	CxBitReaderInit(&reader, inbuf, size, distOffset);
+	CxBitReaderInit(&reader2, inbuf, size, 0xC);
+	if ((result = CxAshReadTables(ctx, &reader2, &reader, symBits, distBits)) != CX_ASH_OK) return result;
+
+	u32 pos = 0;
+	const u32 end = uncompSize < limit ? uncompSize : limit;
+	while (pos < end) {
+		CxBitReaderRefill(&reader2);
+		const u32 sym = CxHuffTableDecode(&ctx->symTable, &reader2);
+		if (sym < 0x100) {
+			pos++;
+		} else {
+			CxBitReaderRefill(&reader);
+			const u32 distsym = CxHuffTableDecode(&ctx->distTable, &reader);
+			const u32 copylen = (sym - 0x100) + 3;
+			CX_CHECK_DATA(copylen <= uncompSize - pos);
+			CX_CHECK_DATA(pos >= distsym + 1);
+			pos += copylen;
+		}
+	}
+
+	// The symbol stream ends where the distance stream starts.
+	CX_CHECK_DATA(reader2.nBits >= 0 && reader.nBits >= 0);
+	const u64 symStreamBits = (u64) (distOffset - 0xC) * 8, symConsumed = CxBitReaderConsumed(&reader2, inbuf + 0xC);
+	CX_CHECK_DATA(symConsumed <= symStreamBits);
+	if (pTight != NULL) {
+		const u64 distStreamBits = (u64) (size - distOffset) * 8;
+		const u64 distConsumed = CxBitReaderConsumed(&reader, inbuf + distOffset);
+		*pTight = pos == uncompSize && symStreamBits - symConsumed < 32 && distStreamBits - distConsumed < 32
+			&& CxAshPaddingIsZero(inbuf + 0xC, symConsumed, symStreamBits)
+			&& CxAshPaddingIsZero(inbuf + distOffset, distConsumed, distStreamBits);
+	}
+	return CX_ASH_OK;
+}
+
+int CxAshDetectBits(CxAshDecompressContext *ctx, const void *src, size_t srcSize, int *pSymBits, int *pDistBits) {
+	const u8 *inbuf = (const u8 *) src;
+	int result;
+
+	if (*pSymBits != 0 && (*pSymBits < CX_ASH_MIN_SYM_BITS || *pSymBits > CX_ASH_MAX_BITS)) return CX_ASH_ERR_INVALID_PARAM;
+	if (*pDistBits != 0 && (*pDistBits < CX_ASH_MIN_DIST_BITS || *pDistBits > CX_ASH_MAX_BITS)) return CX_ASH_ERR_INVALID_PARAM;
+	if (srcSize > UINT32_MAX) return CX_ASH_ERR_INVALID_DATA;
+	const u32 size = (u32) srcSize;
+
+	u32 uncompSize;
+	if ((result = CxAshGetUncompressedSize(inbuf, size, &uncompSize)) != CX_ASH_OK) return result;
+	const u32 distOffset = CxRead32BE(inbuf + 0x8);
+	CX_CHECK_DATA(distOffset >= 0xC && distOffset <= size);
+
+	// The widths of files from the Wii are tried first. Other distance widths go from narrow to wide, since a
+	// tree of narrow distances can often be read as a wider one too, but rarely the other way round. Each tree
+	// is read on its own first, as the two are independent, leaving only the pairs of widths that read both of
+	// them to be tested by decoding.
+	static const int symOrder[] = { 9, 10, 11, 12, 13, 14, 15, 16 };
+	static const int distOrder[] = { 11, 15, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 12, 13, 14, 16 };
+	int symCandidates[CX_ASH_MAX_BITS], distCandidates[CX_ASH_MAX_BITS];
+	int nSym = 0, nDist = 0;
+	for (unsigned int i = 0; i < sizeof(symOrder) / sizeof(symOrder[0]); i++) {
+		const int width = symOrder[i];
+		if (*pSymBits != 0 && width != *pSymBits) continue;
+		result = CxAshProbeTree(ctx, inbuf, 0xC, distOffset, width);
+		if (result == CX_ASH_ERR_NO_MEMORY) return result;
+		if (result == CX_ASH_OK) symCandidates[nSym++] = width;
+	}
+	for (unsigned int i = 0; i < sizeof(distOrder) / sizeof(distOrder[0]); i++) {
+		const int width = distOrder[i];
+		if (*pDistBits != 0 && width != *pDistBits) continue;
+		result = CxAshProbeTree(ctx, inbuf, distOffset, size, width);
+		if (result == CX_ASH_ERR_NO_MEMORY) return result;
+		if (result == CX_ASH_OK) distCandidates[nDist++] = width;
+	}
+
+	// Nearly always a single pair decodes the start of the file. Data repetitive enough to be covered by a few
+	// long matches can let a wrong one through as well, and then the pairs left are told apart by decoding the
+	// whole file, keeping the first whose streams end where they should, or failing that, the first to decode.
+	int pairs[2 * CX_ASH_MAX_BITS * CX_ASH_MAX_BITS];
+	int nPairs = 0;
+	for (int i = 0; i < nSym; i++) {
+		for (int j = 0; j < nDist; j++) {
+			result = CxAshProbeStreams(ctx, inbuf, size, distOffset, uncompSize, symCandidates[i], distCandidates[j],
+				CX_ASH_DETECT_PREFIX, NULL);
+			if (result == CX_ASH_ERR_NO_MEMORY) return result;
+			if (result != CX_ASH_OK) continue;
+			pairs[nPairs++] = symCandidates[i];
+			pairs[nPairs++] = distCandidates[j];
+		}
+	}
+	if (nPairs == 0) return CX_ASH_ERR_INVALID_DATA;
+
+	int chosen = nPairs > 2 ? -1 : 0;
+	for (int i = 0; chosen < 0 && i < nPairs; i += 2) {
+		int tight;
+		result = CxAshProbeStreams(ctx, inbuf, size, distOffset, uncompSize, pairs[i], pairs[i + 1], uncompSize, &tight);
+		if (result == CX_ASH_ERR_NO_MEMORY) return result;
+		if (result != CX_ASH_OK) {
+			pairs[i] = 0;
+		} else if (tight) {
+			chosen = i;
+		}
+	}
+	for (int i = 0; chosen < 0 && i < nPairs; i += 2) {
+		if (pairs[i] != 0) chosen = i;
+	}
+	if (chosen < 0) return CX_ASH_ERR_INVALID_DATA;
+
+	*pSymBits = pairs[chosen];
+	*pDistBits = pairs[chosen + 1];
+	return CX_ASH_OK;
+}
+
+
+#ifdef CX_HAVE_PTHREADS
+
+// Distances are handed from the decoding thread to the consumer in batches, so that the lock is only taken once
+// for every so many of them.
+#define CX_ASH_DIST_BATCH 4096
+
+typedef struct CxAshDistDecoder_ {
+	CxBitReader reader;
+	const CxHuffTable *table;
+	u16 *queue;
+	u32 nMax;          // capacity of the queue, the most matches the output has room for
+	pthread_mutex_t lock;
+	pthread_cond_t published;
+	u32 nPublished;    // number of distances the consumer may read
+	int done;          // set once the decoder has stopped
+	int cancel;        // set by the consumer to stop the decoder early
+} CxAshDistDecoder;
+
+// Decodes the distance stream until it runs out, or the queue is full.
+static void *CxAshDistDecoderProc(void *arg) {
+	CxAshDistDecoder *dec = (CxAshDistDecoder *) arg;
+	CxBitReader *reader = &dec->reader;
+	u32 n = 0;
+	int stop = 0;
+
+	while (!stop) {
+		const u32 batchEnd = (dec->nMax - n > CX_ASH_DIST_BATCH) ? (n + CX_ASH_DIST_BATCH) : dec->nMax;
+		while (n < batchEnd) {
+			CxBitReaderRefill(reader);
+			if (reader->nBits <= 0) break;
+
+			const u32 distsym = CxHuffTableDecode(dec->table, reader);
+			if (reader->nBits < 0) break; // the code was cut off by the end of the data
+			dec->queue[n++] = distsym;
+		}
+		if (n < batchEnd || n == dec->nMax) stop = 1;
+
+		pthread_mutex_lock(&dec->lock);
+		dec->nPublished = n;
+		dec->done = stop;
+		stop |= dec->cancel;
+		pthread_cond_signal(&dec->published);
+		pthread_mutex_unlock(&dec->lock);
+	}
+	return NULL;
+}
+
+// Waits until more than index distances are published. Returns the new number published, or index if the
+// decoder stopped first.
+static u32 CxAshDistDecoderWait(CxAshDistDecoder *dec, u32 index) {
+	pthread_mutex_lock(&dec->lock);
+	while (dec->nPublished <= index && !dec->done) pthread_cond_wait(&dec->published, &dec->lock);
+	const u32 nPublished = dec->nPublished;
+	pthread_mutex_unlock(&dec->lock);
+	return nPublished;
+}
+
+// The decoding loop of CxAshDecompressParallel, taking distances from the queue. Sets *pnMatches to the number of
+// matches, and *pnCopyBytes to the bytes they copied.
+static int CxAshDecompressFromQueue(CxAshDistDecoder *dec, CxBitReader *reader2, const CxHuffTable *symTable, u8 *outbuf,
+	size_t outbufSize, u32 uncompSize, u32 *pnMatches, u32 *pnCopyBytes) {
+	u8 *destp = outbuf;
+	u32 nCopyBytes = 0;
+	const u8 *bufEnd = outbuf + outbufSize;
+	const u16 *queue = dec->queue;
+	u32 nDist = 0, nAvailable = 0;
+
+	while (uncompSize > 0) {
+		CxBitReaderRefill(reader2);
+		const u32 sym = CxHuffTableDecode(symTable, reader2);
+
+		if (sym < 0x100) {
+			*(destp++) = sym;
+			uncompSize--;
+		} else {
+			if (nDist == nAvailable) {
+				nAvailable = CxAshDistDecoderWait(dec, nDist);
+				CX_CHECK_DATA(nDist < nAvailable); // the distance stream ran out
+			}
+			const u32 distsym = queue[nDist++];
+
+			const u32 copylen = (sym - 0x100) + 3;
+			CX_CHECK_DATA(copylen <= uncompSize);             //check length valid
+			CX_CHECK_DATA((destp - outbuf) >= (distsym + 1)); //check source valid
+
+			CxAshCopyMatch(destp, bufEnd, distsym + 1, copylen);
+			destp += copylen;
+			uncompSize -= copylen;
+			nCopyBytes += copylen;
+		}
+	}
+
+	CX_CHECK_DATA(reader2->nBits >= 0);
+	*pnMatches = nDist;
+	*pnCopyBytes = nCopyBytes;
+	return CX_ASH_OK;
+}
+
+#endif
+
+int CxAshDecompressParallel(CxAshDecompressContext *ctx, const void *src, size_t srcSize, void *dest, size_t destSize,
+	int symBits, int distBits) {
+#ifdef CX_HAVE_PTHREADS
+	const u8 *inbuf = (const u8 *) src;
+	int result;
+
+	if ((result = CxAshCheckBits(symBits, distBits)) != CX_ASH_OK) return result;
+	if (srcSize > UINT32_MAX) return CX_ASH_ERR_INVALID_DATA;
+	const u32 size = (u32) srcSize;
+
+	// Starting a thread isn't worth it for small files.
+	u32 uncompSize;
+	if ((result = CxAshGetUncompressedSize(inbuf, size, &uncompSize)) != CX_ASH_OK) return result;
+	if (uncompSize < CX_ASH_PARALLEL_MIN_SIZE) {
+		return CxAshDecompress(ctx, src, srcSize, dest, destSize, symBits, distBits);
+	}
+	if (destSize < uncompSize) return CX_ASH_ERR_BUFFER_SIZE;
+
+	const u32 distOffset = CxRead32BE(inbuf + 0x8);
+	CX_CHECK_DATA(distOffset >= 0xC && distOffset <= size);
+
+	CxAshDistDecoder dec;
+	CxBitReader reader2;
+	CxBitReaderInit(&dec.reader, inbuf, size, distOffset);
+	CxBitReaderInit(&reader2, inbuf, size, 0xC);
+	if ((result = CxAshReadTables(ctx, &reader2, &dec.reader, symBits, distBits)) != CX_ASH_OK) return result;
+
+	// Every match is at least 3 bytes long, which bounds how many distances can be used.
+	const u32 nMax = uncompSize / 3;
+	if (ctx->distQueueSize < nMax) {
+		u16 *queue = realloc(ctx->distQueue, nMax * sizeof(u16));
+		if (queue == NULL) return CX_ASH_ERR_NO_MEMORY;
+		ctx->distQueue = queue;
+		ctx->distQueueSize = nMax;
+	}
+
+	dec.table = &ctx->distTable;
+	dec.queue = ctx->distQueue;
+	dec.nMax = nMax;
+	dec.nPublished = 0;
+	dec.done = 0;
+	dec.cancel = 0;
+	pthread_mutex_init(&dec.lock, NULL);
+	pthread_cond_init(&dec.published, NULL);
+
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, CxAshDistDecoderProc, &dec) != 0) {
+		pthread_cond_destroy(&dec.published);
+		pthread_mutex_destroy(&dec.lock);
+		return CxAshDecompress(ctx, src, srcSize, dest, destSize, symBits, distBits);
+	}
+
+	u32 nMatches = 0, nCopyBytes = 0;
+	result = CxAshDecompressFromQueue(&dec, &reader2, &ctx->symTable, (u8 *) dest, destSize, uncompSize, &nMatches,
+		&nCopyBytes);
+
+	pthread_mutex_lock(&dec.lock);
+	dec.cancel = 1;
+	pthread_mutex_unlock(&dec.lock);
+	pthread_join(thread, NULL);
+	pthread_cond_destroy(&dec.published);
+	pthread_mutex_destroy(&dec.lock);
+
+	// The distance thread has stopped, so its reader can be looked at.
+	if (result == CX_ASH_OK) {
+		CxAshSetInfo(ctx, uncompSize, nMatches, nCopyBytes, CxBitReaderConsumed(&reader2, inbuf + 0xC),
+			CxBitReaderConsumed(&dec.reader, inbuf + distOffset));
+	}
+	return result;
+#else
+	return CxAshDecompress(ctx, src, srcSize, dest, destSize, symBits, distBits);
+#endif
+}
+
+struct CxAshStream_ {
+	CxAshDecompressContext ctx;     // decoding tables
+	CxBitReader symReader;
+	CxBitReader distReader;
+	CxAshSource symSource;
+	CxAshSource distSource;
+	u8 *window;                     // last bytes of output, indexed by output position
+	u32 windowSize;                 // allocated size of the window
+	u32 windowMask;                 // size of the window in use, minus 1
+	u32 outSize;                    // size of the whole output
+	u32 outPos;                     // number of bytes output so far
+	u32 copyLen;                    // bytes left to copy of the current match
+	u32 copyDist;
+	int result;                     // error that ended decompression, if any
+};
+
+CxAshStream *CxAshStreamCreate(void) {
+	return calloc(1, sizeof(CxAshStream));
+}
+
+void CxAshStreamDestroy(CxAshStream *stream) {
+	if (stream == NULL) return;
+	free(stream->ctx.trees);
+	free(stream->ctx.work);
+	CxHuffTableFree(&stream->ctx.symTable);
+	CxHuffTableFree(&stream->ctx.distTable);
+	free(stream->window);
+	free(stream);
+}
+
+static int CxAshStreamStart(CxAshStream *stream, CxAshReadProc proc, void *param, size_t srcSize, int symBits,
+	int distBits) {
+	int result;
+	if ((result = CxAshCheckBits(symBits, distBits)) != CX_ASH_OK) return result;
+
+	u8 header[0xC];
+	if (srcSize < sizeof(header)) return CX_ASH_ERR_INVALID_DATA;
+	if (proc(param, 0, header, sizeof(header)) != sizeof(header)) return CX_ASH_ERR_READ;
+	if ((result = CxAshGetUncompressedSize(header, sizeof(header), &stream->outSize)) != CX_ASH_OK) return result;
+
+	const u32 distOffset = CxRead32BE(header + 0x8);
+	CX_CHECK_DATA(distOffset >= 0xC && distOffset <= srcSize);
+
+	// A match reaches back at most 1 << distBits bytes. The window only needs to hold that much, since the
+	// byte being replaced is read before it is overwritten.
+	const u32 windowSize = 1 << distBits;
+	if (stream->windowSize < windowSize) {
+		free(stream->window);
+		stream->windowSize = 0;
+		stream->window = malloc(windowSize);
+		if (stream->window == NULL) return CX_ASH_ERR_NO_MEMORY;
+		stream->windowSize = windowSize;
+	}
+
+	CxBitReaderInitSource(&stream->symReader, &stream->symSource, proc, param, 0xC, srcSize);
+	CxBitReaderInitSource(&stream->distReader, &stream->distSource, proc, param, distOffset, srcSize);
+	result = CxAshReadTables(&stream->ctx, &stream->symReader, &stream->distReader, symBits, distBits);
+
+	// The trees are only needed while building the tables, so don't hold on to them between files.
+	free(stream->ctx.trees);
+	free(stream->ctx.work);
+	stream->ctx.trees = stream->ctx.work = NULL;
+	stream->ctx.treesSize = stream->ctx.workSize = 0;
+
+	if (stream->symSource.error || stream->distSource.error) return CX_ASH_ERR_READ;
+	if (result != CX_ASH_OK) return result;
+	stream->windowMask = windowSize - 1;
+	return CX_ASH_OK;
+}
+
+int CxAshStreamBegin(CxAshStream *stream, CxAshReadProc proc, void *param, size_t srcSize, int symBits, int distBits) {
+	stream->outSize = 0;
+	stream->outPos = 0;
+	stream->copyLen = 0;
+	stream->copyDist = 0;
+	stream->result = CxAshStreamStart(stream, proc, param, srcSize, symBits, distBits);
+	return stream->result;
+}
+
+uint32_t CxAshStreamGetSize(const CxAshStream *stream) {
+	return stream->outSize;
+}
+
+int CxAshStreamRead(CxAshStream *stream, void *dest, size_t size, size_t *pnWritten) {
+	u8 *destp = (u8 *) dest;
+	*pnWritten = 0;
+	if (stream->result != CX_ASH_OK) return stream->result;
+
+	const CxHuffTable *symTable = &stream->ctx.symTable, *distTable = &stream->ctx.distTable;
+	u8 *window = stream->window;
+	const u32 windowMask = stream->windowMask;
+	u32 outPos = stream->outPos;
+	u32 copyLen = stream->copyLen, copyDist = stream->copyDist;
+
+	u32 nLeft = stream->outSize - outPos;
+	if (size > nLeft) size = nLeft;
+	size_t nWritten = 0;
+	int result = CX_ASH_OK;
+
+	while (nWritten < size) {
+		if (copyLen == 0) {
+			CxBitReader *reader2 = &stream->symReader;
+			CxBitReaderRefill(reader2);
+			const u32 sym = CxHuffTableDecode(symTable, reader2);
+			if (reader2->nBits < 0) {
+				result = stream->symSource.error ? CX_ASH_ERR_READ : CX_ASH_ERR_INVALID_DATA;
+				break;
+			}
+
+			if (sym < 0x100) {
+				window[outPos & windowMask] = sym;
+				destp[nWritten++] = sym;
+				outPos++;
+				continue;
+			}
+
+			CxBitReader *reader = &stream->distReader;
+			CxBitReaderRefill(reader);
+			copyDist = CxHuffTableDecode(distTable, reader) + 1;
+			copyLen = (sym - 0x100) + 3;
+			if (reader->nBits < 0) {
+				result = stream->distSource.error ? CX_ASH_ERR_READ : CX_ASH_ERR_INVALID_DATA;
+				break;
+			}
+			if (copyLen > stream->outSize - outPos || copyDist > outPos) {
+				result = CX_ASH_ERR_INVALID_DATA;
+				break;
+			}
+		}
+
+		// Copy as much of the match as fits, leaving the rest for the next call.
+		u32 n = copyLen;
+		if (n > size - nWritten) n = (u32) (size - nWritten);
+		copyLen -= n;
+		while (n--) {
+			const u8 b = window[(outPos - copyDist) & windowMask];
+			window[outPos & windowMask] = b;
+			destp[nWritten++] = b;
+			outPos++;
+		}
+	}
+
+	stream->outPos = outPos;
+	stream->copyLen = copyLen;
+	stream->copyDist = copyDist;
+	stream->result = result;
+	*pnWritten = nWritten;
+	return result;
+}
+
+
+// An index starts with a header, followed by a table of its checkpoints in order of output position, then the
+// windows they refer to. Each window holds the bytes output before its checkpoint, as many as fit in 1 << distBits.
+#define CX_ASH_INDEX_MAGIC      "ASHX"
+#define CX_ASH_INDEX_VERSION    1
+#define CX_ASH_INDEX_HEADER     0x18  // magic, version, widths, compressed size, output size, distance stream
+                                      // offset, number of checkpoints
+#define CX_ASH_INDEX_CHECKPOINT 0x18  // output position, window offset, then the bit positions of both readers
+                                      // in the compressed data
+
+typedef struct CxAshCheckpoint_ {
+	u32 outPos;
+	u64 symBitPos;
+	u64 distBitPos;
+} CxAshCheckpoint;
+
+static inline void CxWrite32BE(u8 *p, u32 v) {
+	v = CxFromBig32(v);
+	memcpy(p, &v, sizeof(v));
+}
+
+static inline void CxWrite64BE(u8 *p, u64 v) {
+	v = CxFromBig64(v);
+	memcpy(p, &v, sizeof(v));
+}
+
+static u8 *CxAshReserveBytes(u8 **buf, size_t *size, size_t needed) {
+	if (*size < needed) {
+		u8 *newBuf = realloc(*buf, needed);
+		if (newBuf == NULL) return NULL;
+		*buf = newBuf;
+		*size = needed;
+	}
+	return *buf;
+}
+
+// Starts a reader at a bit position in the compressed data. The caller makes sure it is within the data.
+static void CxBitReaderSeek(CxBitReader *reader, const u8 *src, u32 size, u64 bitPos) {
+	CxBitReaderInit(reader, src, size, (u32) (bitPos / 8));
+	CxBitReaderRefill(reader);
+	CxBitReaderConsume(reader, bitPos % 8);
+}
+
+int CxAshBuildIndex(CxAshDecompressContext *ctx, const void *src, size_t srcSize, const void *data, size_t dataSize,
+	int symBits, int distBits, uint32_t interval, const void **pIndex, size_t *pIndexSize) {
+	const u8 *inbuf = (const u8 *) src;
+	const u8 *outbuf = (const u8 *) data;
+	int result;
+
+	if ((result = CxAshCheckBits(symBits, distBits)) != CX_ASH_OK) return result;
+	if (srcSize > UINT32_MAX) return CX_ASH_ERR_INVALID_DATA;
+	const u32 size = (u32) srcSize;
+	if (interval == 0) interval = CX_ASH_INDEX_INTERVAL;
+
+	u32 uncompSize;
+	if ((result = CxAshGetUncompressedSize(inbuf, size, &uncompSize)) != CX_ASH_OK) return result;
+	if (dataSize != uncompSize) return CX_ASH_ERR_INVALID_PARAM;
+	const u32 distOffset = CxRead32BE(inbuf + 0x8);
+	CX_CHECK_DATA(distOffset >= 0xC && distOffset <= size);
+
+	CxBitReader reader, reader2;
+	CxBitReaderInit(&reader, inbuf, size, distOffset);
+	CxBitReaderInit(&reader2, inbuf, size, 0xC);
+	if ((result = CxAshReadTables(ctx, &reader2, &reader, symBits, distBits)) != CX_ASH_OK) return result;
+
+	// A checkpoint is taken at the first symbol starting at or after each multiple of the interval, the first
+	// being the one right after the trees.
+	const u32 maxCheckpoints = uncompSize / interval + 1;
+	CxAshCheckpoint *checkpoints = malloc(maxCheckpoints * sizeof(CxAshCheckpoint));
+	if (checkpoints == NULL) return CX_ASH_ERR_NO_MEMORY;
+	u32 nCheckpoints = 0;
+
+	// The output is checked against the data as it is decoded, so an index is never built from the wrong data.
+	u32 pos = 0;
+	u64 nextCheckpoint = 0;
+	result = CX_ASH_ERR_INVALID_DATA;
+	while (1) {
+		if (pos >= nextCheckpoint && pos < uncompSize) {
+			CxAshCheckpoint *checkpoint = &checkpoints[nCheckpoints++];
+			checkpoint->outPos = pos;
+			checkpoint->symBitPos = CxBitReaderConsumed(&reader2, inbuf);
+			checkpoint->distBitPos = CxBitReaderConsumed(&reader, inbuf);
+			nextCheckpoint = ((u64) pos / interval + 1) * interval;
+		}
+		if (pos == uncompSize) break;
+
+		CxBitReaderRefill(&reader2);
+		const u32 sym = CxHuffTableDecode(&ctx->symTable, &reader2);
+		if (sym < 0x100) {
+			if (outbuf[pos] != sym) break;
+			pos++;
+		} else {
+			CxBitReaderRefill(&reader);
+			const u32 distsym = CxHuffTableDecode(&ctx->distTable, &reader);
+			const u32 copylen = (sym - 0x100) + 3;
+			if (copylen > uncompSize - pos || pos < distsym + 1) break;
+			if (memcmp(outbuf + pos, outbuf + pos - (distsym + 1), copylen) != 0) break;
+			pos += copylen;
+		}
+	}
+	if (pos == uncompSize && reader2.nBits >= 0 && reader.nBits >= 0) result = CX_ASH_OK;
+
+	// Lay the index out. Each window is as much of the output before its checkpoint as a match can reach.
+	const u32 windowSize = 1 << distBits;
+	size_t indexSize = CX_ASH_INDEX_HEADER + (size_t) nCheckpoints * CX_ASH_INDEX_CHECKPOINT;
+	for (u32 i = 0; i < nCheckpoints; i++) {
+		indexSize += checkpoints[i].outPos < windowSize ? checkpoints[i].outPos : windowSize;
+	}
+	u8 *index = NULL;
+	if (result == CX_ASH_OK) {
+		index = CxAshReserveBytes(&ctx->index, &ctx->indexSize, indexSize);
+		if (index == NULL) result = CX_ASH_ERR_NO_MEMORY;
+	}
+	if (result != CX_ASH_OK) {
+		free(checkpoints);
+		return result;
+	}
+
+	memcpy(index, CX_ASH_INDEX_MAGIC, 4);
+	index[4] = CX_ASH_INDEX_VERSION;
+	index[5] = symBits;
+	index[6] = distBits;
+	index[7] = 0;
+	CxWrite32BE(index + 0x08, size);
+	CxWrite32BE(index + 0x0C, uncompSize);
+	CxWrite32BE(index + 0x10, distOffset);
+	CxWrite32BE(index + 0x14, nCheckpoints);
+
+	size_t windowOffset = CX_ASH_INDEX_HEADER + (size_t) nCheckpoints * CX_ASH_INDEX_CHECKPOINT;
+	for (u32 i = 0; i < nCheckpoints; i++) {
+		const CxAshCheckpoint *checkpoint = &checkpoints[i];
+		const u32 windowLen = checkpoint->outPos < windowSize ? checkpoint->outPos : windowSize;
+		u8 *entry = index + CX_ASH_INDEX_HEADER + (size_t) i * CX_ASH_INDEX_CHECKPOINT;
+		CxWrite32BE(entry + 0x00, checkpoint->outPos);
+		CxWrite32BE(entry + 0x04, (u32) windowOffset);
+		CxWrite64BE(entry + 0x08, checkpoint->symBitPos);
+		CxWrite64BE(entry + 0x10, checkpoint->distBitPos);
+		memcpy(index + windowOffset, outbuf + checkpoint->outPos - windowLen, windowLen);
+		windowOffset += windowLen;
+	}
+	free(checkpoints);
+
+	*pIndex = index;
+	*pIndexSize = indexSize;
+	return CX_ASH_OK;
+}
+
+int CxAshDecompressRange(CxAshDecompressContext *ctx, const void *src, size_t srcSize, const void *index,
+	size_t indexSize, int symBits, int distBits, uint32_t offset, void *dest, size_t size) {
+	const u8 *inbuf = (const u8 *) src;
+	const u8 *indexp = (const u8 *) index;
+	int result;
+
+	if (srcSize > UINT32_MAX) return CX_ASH_ERR_INVALID_DATA;
+	const u32 srcLen = (u32) srcSize;
+	u32 uncompSize;
+	if ((result = CxAshGetUncompressedSize(inbuf, srcLen, &uncompSize)) != CX_ASH_OK) return result;
+	const u32 distOffset = CxRead32BE(inbuf + 0x8);
+	CX_CHECK_DATA(distOffset >= 0xC && distOffset <= srcLen);
+	if (offset > uncompSize || size > uncompSize - offset) return CX_ASH_ERR_INVALID_PARAM;
+	if (size == 0) return CX_ASH_OK;
+	const u32 end = offset + (u32) size;
+
+	// Find the last checkpoint at or before the range. Without an index, start from the beginning.
+	u32 cpPos = 0, windowLen = 0;
+	const u8 *window = NULL;
+	u64 symBitPos = 0, distBitPos = 0;
+	if (indexp != NULL) {
+		if (indexSize < CX_ASH_INDEX_HEADER || memcmp(indexp, CX_ASH_INDEX_MAGIC, 4) != 0) return CX_ASH_ERR_INVALID_PARAM;
+		if (indexp[4] != CX_ASH_INDEX_VERSION) return CX_ASH_ERR_INVALID_PARAM;
+		if ((symBits != 0 && symBits != indexp[5]) || (distBits != 0 && distBits != indexp[6])) return CX_ASH_ERR_INVALID_PARAM;
+		symBits = indexp[5];
+		distBits = indexp[6];
+		if ((result = CxAshCheckBits(symBits, distBits)) != CX_ASH_OK) return CX_ASH_ERR_INVALID_PARAM;
+		if (CxRead32BE(indexp + 0x08) != srcLen || CxRead32BE(indexp + 0x0C) != uncompSize
+			|| CxRead32BE(indexp + 0x10) != distOffset) return CX_ASH_ERR_INVALID_PARAM;
+
+		const u32 nCheckpoints = CxRead32BE(indexp + 0x14);
+		if (nCheckpoints == 0 || nCheckpoints > (indexSize - CX_ASH_INDEX_HEADER) / CX_ASH_INDEX_CHECKPOINT) {
+			return CX_ASH_ERR_INVALID_PARAM;
+		}
+		u32 lo = 0, hi = nCheckpoints;
+		while (hi - lo > 1) {
+			const u32 mid = lo + (hi - lo) / 2;
+			if (CxRead32BE(indexp + CX_ASH_INDEX_HEADER + (size_t) mid * CX_ASH_INDEX_CHECKPOINT) <= offset) lo = mid;
+			else hi = mid;
+		}
+
+		// Only the checkpoint used is checked, which is all it takes to keep decoding within bounds.
+		const u8 *entry = indexp + CX_ASH_INDEX_HEADER + (size_t) lo * CX_ASH_INDEX_CHECKPOINT;
+		cpPos = CxRead32BE(entry + 0x00);
+		const u32 windowOffset = CxRead32BE(entry + 0x04);
+		symBitPos = CxRead64BE(entry + 0x08);
+		distBitPos = CxRead64BE(entry + 0x10);
+		windowLen = cpPos < (1u << distBits) ? cpPos : (1u << distBits);
+		if (cpPos > offset || windowOffset > indexSize || windowLen > indexSize - windowOffset) return CX_ASH_ERR_INVALID_PARAM;
+		if (symBitPos < 0xC * 8 || symBitPos > (u64) distOffset * 8) return CX_ASH_ERR_INVALID_PARAM;
+		if (distBitPos < (u64) distOffset * 8 || distBitPos > (u64) srcLen * 8) return CX_ASH_ERR_INVALID_PARAM;
+		window = indexp + windowOffset;
+	}
+	if ((result = CxAshCheckBits(symBits, distBits)) != CX_ASH_OK) return result;
+
+	// The trees are read from the start of each stream, then the readers are moved to the checkpoint.
+	CxBitReader reader, reader2;
+	CxBitReaderInit(&reader, inbuf, srcLen, distOffset);
+	CxBitReaderInit(&reader2, inbuf, srcLen, 0xC);
+	if ((result = CxAshReadTables(ctx, &reader2, &reader, symBits, distBits)) != CX_ASH_OK) return result;
+	if (indexp != NULL) {
+		CxBitReaderSeek(&reader2, inbuf, srcLen, symBitPos);
+		CxBitReaderSeek(&reader, inbuf, srcLen, distBitPos);
+	}
+
+	// Decode into scratch holding the window, then the output from the checkpoint on. The last match may run
+	// past the end of the range by up to the longest match, less one byte.
+	u32 decodeLen = uncompSize - cpPos;
+	const u32 maxOverrun = (1u << symBits) - 0x100 + 2;
+	if (decodeLen - (end - cpPos) > maxOverrun) decodeLen = (end - cpPos) + maxOverrun;
+	u32 nLeft = uncompSize - cpPos;
+	const size_t bufSize = (size_t) windowLen + decodeLen + CX_ASH_DECOMPRESS_PADDING;
+	u8 *buf = CxAshReserveBytes(&ctx->rangeBuf, &ctx->rangeBufSize, bufSize);
+	if (buf == NULL) return CX_ASH_ERR_NO_MEMORY;
+	if (windowLen > 0) memcpy(buf, window, windowLen);
+
+	const u8 *bufEnd = buf + bufSize;
+	u8 *destp = buf + windowLen;
+	u8 *const endp = buf + windowLen + (end - cpPos);
+	while (destp < endp) {
+		CxBitReaderRefill(&reader2);
+		const u32 sym = CxHuffTableDecode(&ctx->symTable, &reader2);
+
+		if (sym < 0x100) {
+			*(destp++) = sym;
+			nLeft--;
+		} else {
+			CxBitReaderRefill(&reader);
+			const u32 distsym = CxHuffTableDecode(&ctx->distTable, &reader);
+
+			const u32 copylen = (sym - 0x100) + 3;
+			CX_CHECK_DATA(copylen <= nLeft);
+			CX_CHECK_DATA((destp - buf) >= (distsym + 1));
+
+			CxAshCopyMatch(destp, bufEnd, distsym + 1, copylen);
+			destp += copylen;
+			nLeft -= copylen;
+		}
+	}
+	CX_CHECK_DATA(reader2.nBits >= 0 && reader.nBits >= 0);
+
+	memcpy(dest, buf + windowLen + (offset - cpPos), size);
+	return CX_ASH_OK;
+}
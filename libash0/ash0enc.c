@@ -0,0 +1,1916 @@
+/* ASH0-tools libash0 "ash0enc.c"
+ * Copyright (c) 2024 Garhoogin and NinjaCheetah
+ * This code is licensed under the MIT license. See LICENSE for more information.
+ *
+ * This file implements the compression routines for compressing to Nintendo's ASH0 format used on the Wii.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
+
+#include "ash0.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CX_HAVE_SSE2
+#include <emmintrin.h>
+#if defined(__GNUC__) || defined(__clang__)
+//AVX2 is only used after checking the processor supports it, which needs the compiler's target attributes.
+#define CX_HAVE_AVX2
+#include <immintrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(__aarch64__) || defined(_M_ARM64)
+#define CX_HAVE_NEON
+#include <arm_neon.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CX_HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+static inline unsigned int CxiCountTrailingZeros32(uint32_t x) {
+	unsigned long i;
+	_BitScanForward(&i, x);
+	return i;
+}
+static inline unsigned int CxiCountTrailingZeros64(uint64_t x) {
+	unsigned long i;
+	_BitScanForward64(&i, x);
+	return i;
+}
+static inline unsigned int CxiCountLeadingZeros64(uint64_t x) {
+	unsigned long i;
+	_BitScanReverse64(&i, x);
+	return 63 - i;
+}
+#else
+#define CxiCountTrailingZeros32(x) ((unsigned int) __builtin_ctz(x))
+#define CxiCountTrailingZeros64(x) ((unsigned int) __builtin_ctzll(x))
+#define CxiCountLeadingZeros64(x)  ((unsigned int) __builtin_clzll(x))
+#endif
+
+static uint32_t LittleToBig(uint32_t i)  {
+	return ((i >> 24) | (i << 24) | ((i & 0x00FF0000) >> 8) | ((i & 0x0000FF00) << 8));
+}
+
+#define min(a,b)    (((a)<(b))?(a):(b))
+#define max(a,b)    (((a)>(b))?(a):(b))
+
+
+typedef struct CxiHuffNode_ {
+	uint16_t sym;
+	uint16_t symMin; //had space to spare, maybe make searches a little simpler
+	uint16_t symMax;
+	uint16_t nRepresent;
+	int freq;
+	struct CxiHuffNode_ *left;
+	struct CxiHuffNode_ *right;
+} CxiHuffNode;
+
+//tokenized LZ data. the low 16 bits hold the symbol written to the symbol stream: a byte literal, or 0x100 and up
+//for a reference. a reference also holds its distance symbol, which is the distance minus one, in the high 16 bits.
+typedef uint32_t CxiLzToken;
+
+static inline CxiLzToken CxiLzTokenLiteral(unsigned int c) {
+	return c;
+}
+
+static inline CxiLzToken CxiLzTokenReference(unsigned int length, unsigned int distance) {
+	return (length - 3 + 0x100) | ((distance - 1) << 16);
+}
+
+static inline unsigned int CxiLzTokenSymbol(CxiLzToken token) {
+	return token & 0xFFFF;
+}
+
+static inline unsigned int CxiLzTokenDistSymbol(CxiLzToken token) {
+	return token >> 16;
+}
+
+static inline int CxiLzTokenIsReference(CxiLzToken token) {
+	return CxiLzTokenSymbol(token) >= 0x100;
+}
+
+//number of bytes a token covers
+static inline unsigned int CxiLzTokenLength(CxiLzToken token) {
+	return CxiLzTokenIsReference(token) ? (CxiLzTokenSymbol(token) - 0x100 + 3) : 1;
+}
+
+//bit stream writer. Bits are gathered in a 64-bit accumulator and flushed a word at a time, in the big endian
+//bit and byte order the stream is stored in. The destination buffer belongs to the caller, and must be sized to
+//fit the whole stream.
+typedef struct BITSTREAM_ {
+	unsigned char *bytes;
+	unsigned int nBytes;
+	unsigned int nBytesAlloc;
+	uint64_t acc;     //pending bits, the most recently written in the least significant position
+	int nAccBits;
+	int error;        //set if more was written than fits in the buffer
+} BITSTREAM;
+
+//scratch buffers kept by a compression context
+#define CX_SCRATCH_SYM_NODES  0
+#define CX_SCRATCH_DST_NODES  1
+#define CX_SCRATCH_SYM_CODES  2
+#define CX_SCRATCH_DST_CODES  3
+#define CX_SCRATCH_TOKENS     4
+#define CX_SCRATCH_LZ_WEIGHTS 5
+#define CX_SCRATCH_MF_HEAD    6
+#define CX_SCRATCH_MF_LINKS   7
+#define CX_SCRATCH_OUTPUT     8
+#define CX_SCRATCH_HUFF_WORK  9
+#define CX_SCRATCH_LEN_INFO   10
+#define CX_SCRATCH_LENS       11
+#define CX_SCRATCH_LEN_INDEX  12
+#define CX_SCRATCH_DST_COSTS  13
+#define CX_SCRATCH_LZ_MATCHES 14
+#define CX_SCRATCH_LZ_FIRST   15
+#define CX_SCRATCH_LZ_BEST    16
+#define CX_SCRATCH_WIDTH_HIST 17
+#define CX_SCRATCH_COUNT      18
+
+typedef struct CxiWorkers_ CxiWorkers;
+
+//scratch memory for compression. Buffers only ever grow, so compressing a batch of files with one context
+//allocates them once rather than for every file.
+struct CxAshCompressContext_ {
+	void *scratch[CX_SCRATCH_COUNT];
+	size_t scratchSize[CX_SCRATCH_COUNT];
+	CxiWorkers *workers;                    //threads for compressing on, created on first use
+	struct CxAshCompressContext_ **threadCtx; //scratch for each thread but the calling one, which uses this context
+	CxAshCompressInfo info;                 //about the last file compressed
+};
+
+static void CxiSelectCompareMemory(void);
+static void CxiWorkersDestroy(CxiWorkers *workers);
+static unsigned int CxiWorkersCount(const CxiWorkers *workers);
+
+
+
+// ----- compression context
+
+CxAshCompressContext *CxAshCompressContextCreate(void) {
+	//contexts may be created on several threads at once, so the kernel is only chosen by the first.
+#ifdef CX_HAVE_PTHREADS
+	static pthread_once_t selectOnce = PTHREAD_ONCE_INIT;
+	pthread_once(&selectOnce, CxiSelectCompareMemory);
+#else
+	CxiSelectCompareMemory();
+#endif
+	return (CxAshCompressContext *) calloc(1, sizeof(CxAshCompressContext));
+}
+
+static void CxiDestroyThreadContexts(CxAshCompressContext *ctx) {
+	if (ctx->workers == NULL) return;
+	for (unsigned int i = 1; i < CxiWorkersCount(ctx->workers); i++) CxAshCompressContextDestroy(ctx->threadCtx[i]);
+	free(ctx->threadCtx);
+	CxiWorkersDestroy(ctx->workers);
+	ctx->threadCtx = NULL;
+	ctx->workers = NULL;
+}
+
+void CxAshCompressContextDestroy(CxAshCompressContext *ctx) {
+	if (ctx == NULL) return;
+	CxiDestroyThreadContexts(ctx);
+	for (int i = 0; i < CX_SCRATCH_COUNT; i++) free(ctx->scratch[i]);
+	free(ctx);
+}
+
+void CxAshCompressGetInfo(const CxAshCompressContext *ctx, CxAshCompressInfo *info) {
+	*info = ctx->info;
+}
+
+//scratch context for the given thread.
+static inline CxAshCompressContext *CxiThreadContext(CxAshCompressContext *ctx, unsigned int thread) {
+	return thread == 0 ? ctx : ctx->threadCtx[thread];
+}
+
+static void *CxiScratchReserve(CxAshCompressContext *ctx, int slot, size_t size, int zero) {
+	if (size == 0) size = 1;
+	if (ctx->scratchSize[slot] < size) {
+		//the old contents are never needed, so don't bother copying them
+		free(ctx->scratch[slot]);
+		ctx->scratch[slot] = malloc(size);
+		ctx->scratchSize[slot] = ctx->scratch[slot] != NULL ? size : 0;
+		if (ctx->scratch[slot] == NULL) return NULL;
+	}
+	if (zero) memset(ctx->scratch[slot], 0, size);
+	return ctx->scratch[slot];
+}
+
+
+
+// ----- worker threads
+
+//runs one share of a job on the given thread. every thread counted by CxiWorkersCount runs its share, the
+//calling thread being thread 0.
+typedef void (*CxiWorkProc)(void *param, unsigned int thread, unsigned int nThreads);
+
+struct CxiWorkers_ {
+	unsigned int nThreads;   //counting the thread that calls CxiWorkersRun
+	unsigned int nAsked;     //threads asked for, of which fewer may have started
+#ifdef CX_HAVE_PTHREADS
+	pthread_t *threads;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;     //signaled when a job is posted, or on shutdown
+	pthread_cond_t done;     //signaled when the last worker finishes its share
+	CxiWorkProc proc;
+	void *param;
+	unsigned int nBusy;      //workers still running their share of the current job
+	unsigned int generation; //incremented for each job, so workers can tell a new one was posted
+	int shutdown;
+#endif
+};
+
+#ifdef CX_HAVE_PTHREADS
+
+typedef struct CxiWorkerParam_ {
+	CxiWorkers *workers;
+	unsigned int thread;
+} CxiWorkerParam;
+
+static void *CxiWorkerProc(void *arg) {
+	CxiWorkerParam *param = (CxiWorkerParam *) arg;
+	CxiWorkers *workers = param->workers;
+	const unsigned int thread = param->thread;
+	free(param);
+	
+	//the thread may only get going after the first job is posted, so it counts jobs from when the workers were
+	//created rather than from when it started.
+	pthread_mutex_lock(&workers->lock);
+	unsigned int generation = 0;
+	while (1) {
+		while (!workers->shutdown && workers->generation == generation) pthread_cond_wait(&workers->wake, &workers->lock);
+		if (workers->shutdown) break;
+		generation = workers->generation;
+		
+		pthread_mutex_unlock(&workers->lock);
+		workers->proc(workers->param, thread, workers->nThreads);
+		pthread_mutex_lock(&workers->lock);
+		if (--workers->nBusy == 0) pthread_cond_signal(&workers->done);
+	}
+	pthread_mutex_unlock(&workers->lock);
+	return NULL;
+}
+
+#endif
+
+static unsigned int CxiWorkersCount(const CxiWorkers *workers) {
+	return workers->nThreads;
+}
+
+static void CxiWorkersDestroy(CxiWorkers *workers) {
+	if (workers == NULL) return;
+	
+#ifdef CX_HAVE_PTHREADS
+	pthread_mutex_lock(&workers->lock);
+	workers->shutdown = 1;
+	pthread_cond_broadcast(&workers->wake);
+	pthread_mutex_unlock(&workers->lock);
+	
+	for (unsigned int i = 1; i < workers->nThreads; i++) pthread_join(workers->threads[i], NULL);
+	free(workers->threads);
+	pthread_mutex_destroy(&workers->lock);
+	pthread_cond_destroy(&workers->wake);
+	pthread_cond_destroy(&workers->done);
+#endif
+	free(workers);
+}
+
+//starts up to nThreads - 1 threads. fewer may be started if the system runs out, down to none at all where
+//threads aren't supported. returns NULL if out of memory.
+static CxiWorkers *CxiWorkersCreate(unsigned int nThreads) {
+	CxiWorkers *workers = (CxiWorkers *) calloc(1, sizeof(CxiWorkers));
+	if (workers == NULL) return NULL;
+	workers->nThreads = 1;
+	workers->nAsked = nThreads;
+	
+#ifdef CX_HAVE_PTHREADS
+	pthread_mutex_init(&workers->lock, NULL);
+	pthread_cond_init(&workers->wake, NULL);
+	pthread_cond_init(&workers->done, NULL);
+	workers->threads = (pthread_t *) calloc(nThreads, sizeof(pthread_t));
+	if (workers->threads == NULL) {
+		CxiWorkersDestroy(workers);
+		return NULL;
+	}
+	for (unsigned int i = 1; i < nThreads; i++) {
+		CxiWorkerParam *param = (CxiWorkerParam *) malloc(sizeof(CxiWorkerParam));
+		if (param == NULL) break;
+		param->workers = workers;
+		param->thread = i;
+		if (pthread_create(&workers->threads[i], NULL, CxiWorkerProc, param) != 0) {
+			free(param);
+			break;
+		}
+		workers->nThreads++;
+	}
+#else
+	(void) nThreads;
+#endif
+	return workers;
+}
+
+//runs proc on every thread, returning once all have finished. without workers, it runs only on the calling thread.
+static void CxiWorkersRun(CxiWorkers *workers, CxiWorkProc proc, void *param) {
+#ifdef CX_HAVE_PTHREADS
+	if (workers != NULL && workers->nThreads > 1) {
+		pthread_mutex_lock(&workers->lock);
+		workers->proc = proc;
+		workers->param = param;
+		workers->nBusy = workers->nThreads - 1;
+		workers->generation++;
+		pthread_cond_broadcast(&workers->wake);
+		pthread_mutex_unlock(&workers->lock);
+		
+		proc(param, 0, workers->nThreads);
+		
+		pthread_mutex_lock(&workers->lock);
+		while (workers->nBusy > 0) pthread_cond_wait(&workers->done, &workers->lock);
+		pthread_mutex_unlock(&workers->lock);
+		return;
+	}
+#endif
+	proc(param, 0, 1);
+}
+
+//makes sure the context has nThreads threads to compress on, each with its own scratch context. a context keeps
+//its threads from one call to the next, only starting them again when a different number is asked for.
+static int CxiEnsureWorkers(CxAshCompressContext *ctx, unsigned int nThreads) {
+	if (ctx->workers != NULL && ctx->workers->nAsked == nThreads) return 1;
+	CxiDestroyThreadContexts(ctx);
+	
+	CxiWorkers *workers = CxiWorkersCreate(nThreads);
+	if (workers == NULL) return 0;
+	CxAshCompressContext **threadCtx = (CxAshCompressContext **) calloc(workers->nThreads, sizeof(CxAshCompressContext *));
+	int ok = threadCtx != NULL;
+	for (unsigned int i = 1; ok && i < workers->nThreads; i++) {
+		threadCtx[i] = CxAshCompressContextCreate();
+		if (threadCtx[i] == NULL) ok = 0;
+	}
+	if (!ok) {
+		for (unsigned int i = 1; threadCtx != NULL && i < workers->nThreads; i++) CxAshCompressContextDestroy(threadCtx[i]);
+		free(threadCtx);
+		CxiWorkersDestroy(workers);
+		return 0;
+	}
+	
+	ctx->workers = workers;
+	ctx->threadCtx = threadCtx;
+	return 1;
+}
+
+
+
+// ----- bit stream
+
+static void CxiBitStreamCreate(BITSTREAM *stream, unsigned char *dest, unsigned int capacity) {
+	stream->bytes = dest;
+	stream->nBytes = 0;
+	stream->nBytesAlloc = capacity;
+	stream->acc = 0;
+	stream->nAccBits = 0;
+	stream->error = 0;
+}
+
+static void CxiBitStreamFlushWord(BITSTREAM *stream, uint32_t word) {
+	if (stream->nBytes + 4 > stream->nBytesAlloc) {
+		stream->error = 1;
+		return;
+	}
+	
+	unsigned char *dest = stream->bytes + stream->nBytes;
+	dest[0] = (word >> 24) & 0xFF;
+	dest[1] = (word >> 16) & 0xFF;
+	dest[2] = (word >>  8) & 0xFF;
+	dest[3] = (word >>  0) & 0xFF;
+	stream->nBytes += 4;
+}
+
+static inline void CxiBitStreamWriteBitsBE(BITSTREAM *stream, uint32_t bits, int nBits) {
+	//append up to 32 bits, most significant first.
+	stream->acc = (stream->acc << nBits) | (bits & ((1ull << nBits) - 1));
+	stream->nAccBits += nBits;
+	if (stream->nAccBits >= 32) {
+		stream->nAccBits -= 32;
+		CxiBitStreamFlushWord(stream, (uint32_t) (stream->acc >> stream->nAccBits));
+	}
+}
+
+static inline void CxiBitStreamWrite(BITSTREAM *stream, int bit) {
+	CxiBitStreamWriteBitsBE(stream, bit, 1);
+}
+
+static int CxiBitStreamFinish(BITSTREAM *stream, unsigned int *size) {
+	//pad the last word with zeroes.
+	if (stream->nAccBits > 0) {
+		CxiBitStreamWriteBitsBE(stream, 0, 32 - stream->nAccBits);
+	}
+	
+	*size = stream->nBytes;
+	return !stream->error;
+}
+
+static unsigned int CxiBitStreamWordAlignedSize(uint64_t nBits) {
+	return (unsigned int) ((nBits + 31) / 32 * 4);
+}
+
+
+// ----- LZ search code
+
+//all comparisons are between two positions of the same buffer. when a match is longer than its distance, it
+//runs into the bytes it's being compared with, which is exactly how a decoder repeats the source, so the plain
+//forward comparison below covers that case too. only the loads overlap.
+
+static inline uint64_t CxiLoad64(const unsigned char *p) {
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+//index of the first differing byte for a nonzero XOR of two 8-byte loads
+static inline unsigned int CxiFirstDifference64(uint64_t diff) {
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+	return CxiCountLeadingZeros64(diff) >> 3;
+#else
+	return CxiCountTrailingZeros64(diff) >> 3;
+#endif
+}
+
+static unsigned int CxiCompareMemoryScalar(const unsigned char *b1, const unsigned char *b2, unsigned int nMax) {
+	unsigned int n = 0;
+	while (n + 8 <= nMax) {
+		uint64_t diff = CxiLoad64(b1 + n) ^ CxiLoad64(b2 + n);
+		if (diff) return n + CxiFirstDifference64(diff);
+		n += 8;
+	}
+	while (n < nMax && b1[n] == b2[n]) n++;
+	return n;
+}
+
+#ifdef CX_HAVE_SSE2
+static unsigned int CxiCompareMemorySSE2(const unsigned char *b1, const unsigned char *b2, unsigned int nMax) {
+	unsigned int n = 0;
+	while (n + 16 <= nMax) {
+		__m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (b1 + n)), _mm_loadu_si128((const __m128i *) (b2 + n)));
+		unsigned int mask = (unsigned int) _mm_movemask_epi8(eq) ^ 0xFFFF;
+		if (mask) return n + CxiCountTrailingZeros32(mask);
+		n += 16;
+	}
+	return n + CxiCompareMemoryScalar(b1 + n, b2 + n, nMax - n);
+}
+#endif
+
+#ifdef CX_HAVE_AVX2
+__attribute__((target("avx2")))
+static unsigned int CxiCompareMemoryAVX2(const unsigned char *b1, const unsigned char *b2, unsigned int nMax) {
+	unsigned int n = 0;
+	while (n + 32 <= nMax) {
+		__m256i eq = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (b1 + n)), _mm256_loadu_si256((const __m256i *) (b2 + n)));
+		unsigned int mask = ~(unsigned int) _mm256_movemask_epi8(eq);
+		if (mask) return n + CxiCountTrailingZeros32(mask);
+		n += 32;
+	}
+	return n + CxiCompareMemorySSE2(b1 + n, b2 + n, nMax - n);
+}
+#endif
+
+#ifdef CX_HAVE_NEON
+static unsigned int CxiCompareMemoryNEON(const unsigned char *b1, const unsigned char *b2, unsigned int nMax) {
+	unsigned int n = 0;
+	while (n + 16 <= nMax) {
+		uint8x16_t eq = vceqq_u8(vld1q_u8(b1 + n), vld1q_u8(b2 + n));
+		
+		//narrow the comparison to 4 bits per byte, then find the first byte that isn't all ones.
+		uint8x8_t narrowed = vshrn_n_u16(vreinterpretq_u16_u8(eq), 4);
+		uint64_t mask = ~vget_lane_u64(vreinterpret_u64_u8(narrowed), 0);
+		if (mask) return n + (CxiCountTrailingZeros64(mask) >> 2);
+		n += 16;
+	}
+	return n + CxiCompareMemoryScalar(b1 + n, b2 + n, nMax - n);
+}
+#endif
+
+typedef unsigned int (*CxiCompareProc)(const unsigned char *b1, const unsigned char *b2, unsigned int nMax);
+
+//kernel for the bytes after the first 8, chosen for the processor by CxiSelectCompareMemory.
+static CxiCompareProc sCompareMemoryLong = CxiCompareMemoryScalar;
+
+static void CxiSelectCompareMemory(void) {
+	CxiCompareProc proc = CxiCompareMemoryScalar;
+#if defined(CX_HAVE_NEON)
+	proc = CxiCompareMemoryNEON;
+#elif defined(CX_HAVE_SSE2)
+	proc = CxiCompareMemorySSE2;
+#ifdef CX_HAVE_AVX2
+	if (__builtin_cpu_supports("avx2")) proc = CxiCompareMemoryAVX2;
+#endif
+#endif
+	sCompareMemoryLong = proc;
+}
+
+//returns the number of leading bytes b1 and b2 have in common, up to nMax.
+static inline unsigned int CxiCompareMemory(const unsigned char *b1, const unsigned char *b2, unsigned int nMax) {
+	//most candidates fail within a few bytes, so the first word is compared without calling out.
+	if (nMax >= 8) {
+		uint64_t diff = CxiLoad64(b1) ^ CxiLoad64(b2);
+		if (diff) return CxiFirstDifference64(diff);
+		return 8 + sCompareMemoryLong(b1 + 8, b2 + 8, nMax - 8);
+	}
+	
+	unsigned int n = 0;
+	while (n < nMax && b1[n] == b2[n]) n++;
+	return n;
+}
+
+// ----- match finder
+
+//positions are stored in the hash heads and links offset by 1, so that 0 can mark an empty slot.
+#define CX_MF_HASH_BITS   16
+#define CX_MF_HASH_SIZE   (1 << CX_MF_HASH_BITS)
+#define CX_MF_MIN_MATCH   3
+
+#define CX_MF_HASH_CHAIN  0 //hash chains keyed on 3-byte prefixes
+#define CX_MF_BINARY_TREE 1 //binary search trees keyed on 3-byte prefixes, ordered by the following bytes
+#define CX_MF_HASH_TABLE  2 //only the last position of each 3-byte prefix, for the greedy parse
+
+typedef struct CxiMatchFinder_ {
+	const unsigned char *buffer;
+	unsigned int size;
+	unsigned int maxDistance; //furthest distance a match may be found at
+	unsigned int maxDepth;    //maximum number of candidates visited per search
+	unsigned int cyclicMask;  //binary tree only: mask for indexing the cyclic node buffer
+	int type;
+	uint32_t *head;           //most recent position inserted for each hash value
+	uint32_t *links;          //hash chain: previous position per position; binary tree: child pairs per window slot
+	uint64_t nProbes;         //candidates visited by the searches
+} CxiMatchFinder;
+
+static inline uint32_t CxiMatchFinderHash(const unsigned char *p) {
+	uint32_t v = (p[0] << 16) | (p[1] << 8) | p[2];
+	return (v * 2654435761u) >> (32 - CX_MF_HASH_BITS);
+}
+
+static int CxiMatchFinderInit(CxAshCompressContext *ctx, CxiMatchFinder *mf, const unsigned char *buffer, unsigned int size, unsigned int maxDistance, unsigned int maxDepth, int type) {
+	mf->buffer = buffer;
+	mf->size = size;
+	mf->maxDistance = maxDistance;
+	mf->maxDepth = maxDepth ? maxDepth : UINT_MAX; //0 = unlimited
+	mf->type = type;
+	mf->cyclicMask = 0;
+	mf->nProbes = 0;
+
+	size_t nLinks;
+	if (type == CX_MF_BINARY_TREE) {
+		//the tree only needs nodes for positions within the window, so store them cyclically.
+		unsigned int cyclicSize = 1;
+		while (cyclicSize <= maxDistance) cyclicSize <<= 1;
+		mf->cyclicMask = cyclicSize - 1;
+		nLinks = 2 * (size_t) cyclicSize;
+	} else {
+		nLinks = size;
+	}
+
+	//the arrays belong to the context
+	mf->head = (uint32_t *) CxiScratchReserve(ctx, CX_SCRATCH_MF_HEAD, CX_MF_HASH_SIZE * sizeof(uint32_t), 1);
+	mf->links = (uint32_t *) CxiScratchReserve(ctx, CX_SCRATCH_MF_LINKS, nLinks * sizeof(uint32_t), 1);
+	return mf->head != NULL && mf->links != NULL;
+}
+
+static unsigned int CxiMatchFinderHashChain(CxiMatchFinder *mf, unsigned int pos, unsigned int maxLength, int search, unsigned int *pDistance) {
+	const unsigned char *buffer = mf->buffer;
+	uint32_t hash = CxiMatchFinderHash(buffer + pos);
+	uint32_t cur = mf->head[hash];
+
+	//link this position into the chain
+	mf->head[hash] = pos + 1;
+	mf->links[pos] = cur;
+	if (!search) return 0;
+
+	//walk the chain from the most recent position, so that ties in length resolve to the nearest distance.
+	unsigned int biggestRun = 0, biggestRunDistance = 0;
+	unsigned int depth = mf->maxDepth;
+	while (cur != 0 && depth-- > 0) {
+		unsigned int candidate = cur - 1;
+		unsigned int distance = pos - candidate;
+		if (distance > mf->maxDistance) break;
+		mf->nProbes++;
+
+		//the match may overlap the current position, which the decoder resolves by repeating the source.
+		unsigned int nMatched = CxiCompareMemory(buffer + candidate, buffer + pos, maxLength);
+		if (nMatched > biggestRun) {
+			biggestRun = nMatched;
+			biggestRunDistance = distance;
+			if (biggestRun == maxLength) break;
+		}
+		cur = mf->links[candidate];
+	}
+
+	*pDistance = biggestRunDistance;
+	return biggestRun;
+}
+
+//like CxiMatchFinderHashChain, but finds the longest match within every window width up to maxWidth at once,
+//setting lengths[w] and distances[w] to the one within 1 << w. the chain runs from the nearest position out, so
+//the best match within a window is the best found by the time the chain leaves it.
+static void CxiMatchFinderHashChainWindows(CxiMatchFinder *mf, unsigned int pos, unsigned int maxLength, int maxWidth, unsigned int *lengths, unsigned int *distances) {
+	const unsigned char *buffer = mf->buffer;
+	uint32_t hash = CxiMatchFinderHash(buffer + pos);
+	uint32_t cur = mf->head[hash];
+	mf->head[hash] = pos + 1;
+	mf->links[pos] = cur;
+
+	unsigned int biggestRun = 0, biggestRunDistance = 0;
+	unsigned int depth = mf->maxDepth;
+	int width = 1;
+	while (cur != 0 && depth-- > 0) {
+		unsigned int candidate = cur - 1;
+		unsigned int distance = pos - candidate;
+		if (distance > mf->maxDistance) break;
+		while (distance > (1u << width)) {
+			lengths[width] = biggestRun;
+			distances[width] = biggestRunDistance;
+			width++;
+		}
+		mf->nProbes++;
+
+		unsigned int nMatched = CxiCompareMemory(buffer + candidate, buffer + pos, maxLength);
+		if (nMatched > biggestRun) {
+			biggestRun = nMatched;
+			biggestRunDistance = distance;
+			if (biggestRun == maxLength) break;
+		}
+		cur = mf->links[candidate];
+	}
+	for (; width <= maxWidth; width++) {
+		lengths[width] = biggestRun;
+		distances[width] = biggestRunDistance;
+	}
+}
+
+static unsigned int CxiMatchFinderBinaryTree(CxiMatchFinder *mf, unsigned int pos, unsigned int maxLength, int search, unsigned int *pDistance) {
+	const unsigned char *buffer = mf->buffer;
+	const unsigned char *cur = buffer + pos;
+	uint32_t *links = mf->links;
+	uint32_t hash = CxiMatchFinderHash(cur);
+	uint32_t next = mf->head[hash];
+	mf->head[hash] = pos + 1;
+
+	//re-root the tree at this position. Strings greater than the current one are collected on the right
+	//side of the new root, and lesser strings on the left side.
+	uint32_t *ptrLess = &links[2 * (pos & mf->cyclicMask) + 0];
+	uint32_t *ptrGreater = &links[2 * (pos & mf->cyclicMask) + 1];
+	unsigned int lenLess = 0, lenGreater = 0;
+
+	unsigned int biggestRun = 0, biggestRunDistance = 0;
+	unsigned int depth = mf->maxDepth;
+	while (1) {
+		unsigned int candidate = next - 1;
+		if (next == 0 || (pos - candidate) > mf->maxDistance || depth-- == 0) {
+			*ptrLess = *ptrGreater = 0;
+			break;
+		}
+
+		uint32_t *pair = &links[2 * (candidate & mf->cyclicMask)];
+		const unsigned char *pb = buffer + candidate;
+		mf->nProbes++;
+
+		//both sides of the tree share a known common prefix with the current string.
+		unsigned int len = min(lenLess, lenGreater);
+		len += CxiCompareMemory(pb + len, cur + len, maxLength - len);
+
+		if (len > biggestRun) {
+			biggestRun = len;
+			biggestRunDistance = pos - candidate;
+			if (len == maxLength) {
+				//identical string, the candidate is replaced by the current position and its subtrees adopted.
+				*ptrLess = pair[0];
+				*ptrGreater = pair[1];
+				break;
+			}
+		}
+
+		if (pb[len] < cur[len]) {
+			*ptrLess = next;
+			ptrLess = &pair[1];
+			next = *ptrLess;
+			lenLess = len;
+		} else {
+			*ptrGreater = next;
+			ptrGreater = &pair[0];
+			next = *ptrGreater;
+			lenGreater = len;
+		}
+	}
+
+	if (!search) return 0;
+	*pDistance = biggestRunDistance;
+	return biggestRun;
+}
+
+static unsigned int CxiMatchFinderFind(CxiMatchFinder *mf, unsigned int pos, unsigned int maxLength, unsigned int *pDistance) {
+	//find the longest match at pos and insert pos. All positions before pos must have been inserted.
+	*pDistance = 0;
+	if (maxLength > mf->size - pos) maxLength = mf->size - pos;
+	if (maxLength < CX_MF_MIN_MATCH) return 0;
+
+	if (mf->type == CX_MF_BINARY_TREE) return CxiMatchFinderBinaryTree(mf, pos, maxLength, 1, pDistance);
+	return CxiMatchFinderHashChain(mf, pos, maxLength, 1, pDistance);
+}
+
+static void CxiMatchFinderSkip(CxiMatchFinder *mf, unsigned int pos, unsigned int count, unsigned int maxLength) {
+	//insert positions covered by a match without searching them.
+	unsigned int distance;
+	for (unsigned int i = 0; i < count; i++, pos++) {
+		unsigned int len = maxLength;
+		if (len > mf->size - pos) len = mf->size - pos;
+		if (len < CX_MF_MIN_MATCH) return;
+
+		if (mf->type == CX_MF_BINARY_TREE) CxiMatchFinderBinaryTree(mf, pos, len, 0, &distance);
+		else CxiMatchFinderHashChain(mf, pos, len, 0, &distance);
+	}
+}
+
+
+
+// ----- Huffman tree code
+
+#define ISLEAF(n) ((n)->left==NULL&&(n)->right==NULL)
+
+static void CxiHuffmanInit(CxiHuffNode *nodes, unsigned int nNodes) {
+	memset(nodes, 0, nNodes * 2 * sizeof(CxiHuffNode));
+	for (unsigned int i = 0; i < nNodes; i++) {
+		nodes[i].symMin = nodes[i].symMax = nodes[i].sym = i;
+		nodes[i].nRepresent = 1;
+	}
+}
+
+static void CxiHuffmanMakeShallowFirst(CxiHuffNode *node) {
+	if (ISLEAF(node)) return;
+	if (node->left->nRepresent > node->right->nRepresent) {
+		CxiHuffNode *left = node->left;
+		node->left = node->right;
+		node->right = left;
+	}
+	CxiHuffmanMakeShallowFirst(node->left);
+	CxiHuffmanMakeShallowFirst(node->right);
+}
+
+//the heap is ordered by frequency. ties go to the higher node index, which for leaves is the higher symbol and
+//for branches the one made later, so the tree built depends only on the frequencies.
+static inline int CxiHuffmanHeapLess(const CxiHuffNode *nodes, uint32_t a, uint32_t b) {
+	if (nodes[a].freq != nodes[b].freq) return nodes[a].freq < nodes[b].freq;
+	return a > b;
+}
+
+static void CxiHuffmanHeapSiftDown(const CxiHuffNode *nodes, uint32_t *heap, unsigned int nHeap, unsigned int i) {
+	uint32_t node = heap[i];
+	while (1) {
+		unsigned int child = 2 * i + 1;
+		if (child >= nHeap) break;
+		if (child + 1 < nHeap && CxiHuffmanHeapLess(nodes, heap[child + 1], heap[child])) child++;
+		if (!CxiHuffmanHeapLess(nodes, heap[child], node)) break;
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = node;
+}
+
+static void CxiHuffmanHeapPush(const CxiHuffNode *nodes, uint32_t *heap, unsigned int *nHeap, uint32_t node) {
+	unsigned int i = (*nHeap)++;
+	while (i > 0) {
+		unsigned int parent = (i - 1) / 2;
+		if (!CxiHuffmanHeapLess(nodes, node, heap[parent])) break;
+		heap[i] = heap[parent];
+		i = parent;
+	}
+	heap[i] = node;
+}
+
+static uint32_t CxiHuffmanHeapPop(const CxiHuffNode *nodes, uint32_t *heap, unsigned int *nHeap) {
+	uint32_t top = heap[0];
+	heap[0] = heap[--(*nHeap)];
+	if (*nHeap > 0) CxiHuffmanHeapSiftDown(nodes, heap, *nHeap, 0);
+	return top;
+}
+
+//builds a tree from the frequencies of nodes[0..nNodes-1], which stay where they are. branches are placed after
+//them. heap must have room for nNodes entries. returns the root.
+static CxiHuffNode *CxiHuffmanConstructTree(CxiHuffNode *nodes, int nNodes, uint32_t *heap) {
+	//heapify the symbols in use
+	unsigned int nHeap = 0;
+	for (int i = 0; i < nNodes; i++) {
+		if (nodes[i].freq) heap[nHeap++] = i;
+	}
+	for (unsigned int i = nHeap / 2; i-- > 0;) CxiHuffmanHeapSiftDown(nodes, heap, nHeap, i);
+	
+	//merge the two least frequent roots until one is left
+	uint32_t nTotalNodes = nNodes;
+	while (nHeap > 1) {
+		CxiHuffNode *right = nodes + CxiHuffmanHeapPop(nodes, heap, &nHeap);
+		CxiHuffNode *left = nodes + CxiHuffmanHeapPop(nodes, heap, &nHeap);
+		CxiHuffNode *branch = nodes + nTotalNodes;
+
+		branch->freq = left->freq + right->freq;
+		branch->sym = 0;
+		branch->left = left;
+		branch->right = right;
+		branch->symMin = min(left->symMin, right->symMin);
+		branch->symMax = max(right->symMax, left->symMax);
+		branch->nRepresent = left->nRepresent + right->nRepresent; //may overflow for root, but the root doesn't really matter for this
+
+		CxiHuffmanHeapPush(nodes, heap, &nHeap, nTotalNodes++);
+	}
+	
+	CxiHuffNode *root = nodes + heap[0];
+
+	//just to be sure, make sure the shallow node always comes first
+	CxiHuffmanMakeShallowFirst(root);
+	return root;
+}
+
+//flattened form of a Huffman tree, indexed by symbol. Symbols absent from the tree have a length of 0.
+typedef struct CxiHuffCode_ {
+	uint64_t code;       //path from the root, the first bit in the most significant position
+	unsigned int length; //number of bits in the code
+} CxiHuffCode;
+
+static void CxiHuffmanBuildCodesInternal(const CxiHuffNode *tree, CxiHuffCode *codes, uint64_t code, unsigned int depth) {
+	if (tree->left == NULL) {
+		codes[tree->sym].code = code;
+		codes[tree->sym].length = depth;
+	} else {
+		CxiHuffmanBuildCodesInternal(tree->left, codes, (code << 1) | 0, depth + 1);
+		CxiHuffmanBuildCodesInternal(tree->right, codes, (code << 1) | 1, depth + 1);
+	}
+}
+
+static void CxiHuffmanBuildCodes(const CxiHuffNode *tree, CxiHuffCode *codes, unsigned int nSyms) {
+	//walk the tree once, so that lookups of code lengths and codewords need not search it.
+	memset(codes, 0, nSyms * sizeof(CxiHuffCode));
+	CxiHuffmanBuildCodesInternal(tree, codes, 0, 0);
+}
+
+static void CxiHuffmanWriteCode(BITSTREAM *bits, const CxiHuffCode *code) {
+	unsigned int length = code->length;
+	if (length > 32) {
+		CxiBitStreamWriteBitsBE(bits, (uint32_t) (code->code >> 32), length - 32);
+		length = 32;
+	}
+	CxiBitStreamWriteBitsBE(bits, (uint32_t) code->code, length);
+}
+
+typedef struct CxiHuffSymbolInfo_ {
+	uint16_t sym;
+	uint16_t depth;
+} CxiHuffSymbolInfo;
+
+//lists the symbols from nMin up that have a code into buf, which must have room for nSyms - nMin entries.
+//returns the number listed.
+static int CxiHuffmanEnumerateSymbolInfo(const CxiHuffCode *codes, unsigned int nSyms, unsigned int nMin, CxiHuffSymbolInfo *buf) {
+	//the code table is indexed by symbol, so this comes out sorted.
+	CxiHuffSymbolInfo *info = buf;
+	for (unsigned int i = nMin; i < nSyms; i++) {
+		if (codes[i].length == 0) continue;
+		info->sym = i;
+		info->depth = codes[i].length;
+		info++;
+	}
+	return (int) (info - buf);
+}
+
+static uint64_t CxiHuffmanTreeBits(const CxiHuffCode *codes, unsigned int nSyms, int nBits) {
+	//size of the tree as written by CxiAshWriteTree: a bit per branch, a bit and the symbol value per leaf.
+	uint64_t nLeaves = 0;
+	for (unsigned int i = 0; i < nSyms; i++) {
+		if (codes[i].length) nLeaves++;
+	}
+	if (nLeaves == 0) return 0;
+	return (nLeaves - 1) + nLeaves * (1 + nBits);
+}
+
+//codes are held in 64 bits, so no tree is deeper than this.
+#define CX_HUFF_MAX_CODE_LENGTH 64
+
+//replaces a tree with canonical codes no longer than maxLength bits, rebuilding it from them. the limit is raised
+//if the symbols can't fit within it. work must have room for nSyms entries. returns the new root.
+static CxiHuffNode *CxiHuffmanMakeCanonical(CxiHuffNode *nodes, CxiHuffCode *codes, unsigned int nSyms, unsigned int maxLength, uint32_t *work) {
+	unsigned int count[CX_HUFF_MAX_CODE_LENGTH + 1] = { 0 };
+	unsigned int nLeaves = 0;
+	for (unsigned int i = 0; i < nSyms; i++) {
+		if (codes[i].length) {
+			count[codes[i].length]++;
+			nLeaves++;
+		}
+	}
+	
+	unsigned int minLength = 0;
+	while ((1u << minLength) < nLeaves) minLength++;
+	if (maxLength < minLength) maxLength = minLength;
+	if (maxLength > CX_HUFF_MAX_CODE_LENGTH) maxLength = CX_HUFF_MAX_CODE_LENGTH;
+	
+	//list the symbols from shortest to longest code, so the least frequent come last.
+	unsigned int offset[CX_HUFF_MAX_CODE_LENGTH + 1];
+	unsigned int nListed = 0;
+	for (unsigned int len = 1; len <= CX_HUFF_MAX_CODE_LENGTH; len++) {
+		offset[len] = nListed;
+		nListed += count[len];
+	}
+	for (unsigned int i = 0; i < nSyms; i++) {
+		if (codes[i].length) work[offset[codes[i].length]++] = i;
+	}
+	
+	//shorten codes that are too long. Two leaves at the deepest level are replaced by one a level up, and another
+	//leaf is moved down a level to pair with the other. This keeps the code complete.
+	for (unsigned int len = CX_HUFF_MAX_CODE_LENGTH; len > maxLength; len--) {
+		while (count[len] > 0) {
+			unsigned int j = len - 2;
+			while (count[j] == 0) j--;
+			count[len] -= 2;
+			count[len - 1]++;
+			count[j + 1] += 2;
+			count[j]--;
+		}
+	}
+	
+	//hand out the new lengths in order, and number the codes of each length by symbol.
+	uint64_t nextCode[CX_HUFF_MAX_CODE_LENGTH + 2];
+	nextCode[1] = 0;
+	for (unsigned int len = 1; len <= CX_HUFF_MAX_CODE_LENGTH; len++) {
+		nextCode[len + 1] = (nextCode[len] + count[len]) << 1;
+	}
+	unsigned int len = 1;
+	for (unsigned int i = 0; i < nLeaves; i++) {
+		while (count[len] == 0) len++;
+		count[len]--;
+		codes[work[i]].length = len;
+	}
+	for (unsigned int i = 0; i < nSyms; i++) {
+		if (codes[i].length) codes[i].code = nextCode[codes[i].length]++;
+	}
+	
+	//rebuild the tree from the codes, placing the branches after the leaves as before.
+	memset(nodes + nSyms, 0, nSyms * sizeof(CxiHuffNode));
+	CxiHuffNode *root = nodes + nSyms;
+	unsigned int nBranches = 1;
+	for (unsigned int i = 0; i < nSyms; i++) {
+		if (codes[i].length == 0) continue;
+		
+		CxiHuffNode *node = root;
+		for (unsigned int bit = codes[i].length; bit-- > 1;) {
+			CxiHuffNode **child = ((codes[i].code >> bit) & 1) ? &node->right : &node->left;
+			if (*child == NULL) *child = nodes + nSyms + nBranches++;
+			node = *child;
+		}
+		if (codes[i].code & 1) node->right = nodes + i;
+		else node->left = nodes + i;
+	}
+	return root;
+}
+
+
+// ----- ASH code
+
+static void CxiAshEnsureTreeElements(CxiHuffNode *nodes, int nNodes, int nMinNodes) {
+	//count nodes
+	int nPresent = 0;
+	for (int i = 0; i < nNodes; i++) {
+		if (nodes[i].freq) nPresent++;
+	}
+	
+	//have sufficient nodes?
+	if (nPresent >= nMinNodes) return;
+	
+	//add dummy nodes
+	for (int i = 0; i < nNodes; i++) {
+		if (nodes[i].freq == 0) {
+			nodes[i].freq = 1;
+			nPresent++;
+			if (nPresent >= nMinNodes) return;
+		}
+	}
+}
+
+static void CxiAshWriteTree(BITSTREAM *stream, CxiHuffNode *nodes, int nBits) {
+	if (nodes->left != NULL) {
+		//
+		CxiBitStreamWrite(stream, 1);
+		CxiAshWriteTree(stream, nodes->left, nBits);
+		CxiAshWriteTree(stream, nodes->right, nBits);
+	} else {
+		//write value
+		CxiBitStreamWrite(stream, 0);
+		CxiBitStreamWriteBitsBE(stream, nodes->sym, nBits);
+	}
+}
+
+//the fast levels. the greedy parse looks one candidate up in a table small enough to stay in the cache, and takes
+//any match it finds. the lazy parse searches a few candidates of the hash chains, and puts a match off by a byte
+//when the next position starts a longer one, unless the match is already long enough to keep.
+#define CX_LZ_FAST_HASH_BITS 13
+#define CX_LZ_LAZY_DEPTH     16
+#define CX_LZ_LAZY_GOOD      32
+
+static inline uint32_t CxiLzFastHash(const unsigned char *p) {
+	uint32_t v = (p[0] << 16) | (p[1] << 8) | p[2];
+	return (v * 2654435761u) >> (32 - CX_LZ_FAST_HASH_BITS);
+}
+
+//greedy parse of the bytes from window to size of base, the bytes before window only being looked back into.
+static int CxiAshTokenizeGreedy(CxAshCompressContext *ctx, const unsigned char *base, unsigned int window, unsigned int size, unsigned int maxLength, unsigned int maxDistance, CxiLzToken *tokenBuffer, unsigned int *pnTokens, uint64_t *pnProbes) {
+	uint32_t *table = (uint32_t *) CxiScratchReserve(ctx, CX_SCRATCH_MF_HEAD, (1 << CX_LZ_FAST_HASH_BITS) * sizeof(uint32_t), 1);
+	if (table == NULL) return 0;
+	
+	//positions are stored offset by 1, so that 0 can mark an empty slot.
+	unsigned int nTokens = 0;
+	uint64_t nProbes = 0;
+	const unsigned int lastHashed = size >= CX_MF_MIN_MATCH ? size - CX_MF_MIN_MATCH + 1 : 0;
+	for (unsigned int pos = 0; pos < window && pos < lastHashed; pos++) table[CxiLzFastHash(base + pos)] = pos + 1;
+	
+	unsigned int curpos = window;
+	while (curpos < size) {
+		if (curpos < lastHashed) {
+			uint32_t *slot = &table[CxiLzFastHash(base + curpos)];
+			unsigned int candidate = *slot;
+			*slot = curpos + 1;
+			if (candidate != 0 && curpos - (candidate - 1) <= maxDistance) {
+				nProbes++;
+				unsigned int length = CxiCompareMemory(base + candidate - 1, base + curpos, min(maxLength, size - curpos));
+				if (length >= CX_MF_MIN_MATCH) {
+					tokenBuffer[nTokens++] = CxiLzTokenReference(length, curpos - (candidate - 1));
+					
+					//the positions the match covers go into the table too, so that later matches can start there.
+					unsigned int end = curpos + length;
+					for (curpos++; curpos < end && curpos < lastHashed; curpos++) table[CxiLzFastHash(base + curpos)] = curpos + 1;
+					curpos = end;
+					continue;
+				}
+			}
+		}
+		tokenBuffer[nTokens++] = CxiLzTokenLiteral(base[curpos]);
+		curpos++;
+	}
+	
+	*pnTokens = nTokens;
+	*pnProbes = nProbes;
+	return 1;
+}
+
+//lazy parse of the bytes from window to the end of the match finder's buffer.
+static void CxiAshTokenizeLazy(CxiMatchFinder *mf, unsigned int window, unsigned int maxLength, CxiLzToken *tokenBuffer, unsigned int *pnTokens) {
+	const unsigned char *base = mf->buffer;
+	unsigned int nTokens = 0;
+	unsigned int curpos = window;
+	unsigned int distance;
+	unsigned int length = curpos < mf->size ? CxiMatchFinderFind(mf, curpos, maxLength, &distance) : 0;
+	while (curpos < mf->size) {
+		if (length < CX_MF_MIN_MATCH) {
+			tokenBuffer[nTokens++] = CxiLzTokenLiteral(base[curpos]);
+			curpos++;
+		} else if (length < CX_LZ_LAZY_GOOD && curpos + 1 < mf->size) {
+			//a longer match at the next position is worth a literal first.
+			unsigned int nextDistance;
+			unsigned int nextLength = CxiMatchFinderFind(mf, curpos + 1, maxLength, &nextDistance);
+			if (nextLength > length) {
+				tokenBuffer[nTokens++] = CxiLzTokenLiteral(base[curpos]);
+				curpos++;
+				length = nextLength;
+				distance = nextDistance;
+				continue;
+			}
+			
+			//the position after the match's first was inserted by the look ahead
+			tokenBuffer[nTokens++] = CxiLzTokenReference(length, distance);
+			CxiMatchFinderSkip(mf, curpos + 2, length - 2, maxLength);
+			curpos += length;
+		} else {
+			tokenBuffer[nTokens++] = CxiLzTokenReference(length, distance);
+			CxiMatchFinderSkip(mf, curpos + 1, length - 1, maxLength);
+			curpos += length;
+		}
+		length = curpos < mf->size ? CxiMatchFinderFind(mf, curpos, maxLength, &distance) : 0;
+	}
+	*pnTokens = nTokens;
+}
+
+//tokenizes the bytes from start to end, which may refer back to the bytes before start, writing at most
+//end - start tokens. the match finder is held by ctx. *pnProbes is set to the match candidates visited.
+static int CxiAshTokenizeRange(CxAshCompressContext *ctx, const unsigned char *buffer, unsigned int start, unsigned int end, int nSymBits, int nDstBits, int mfType, int fastLevel, unsigned int searchDepth, CxiLzToken *tokenBuffer, unsigned int *pnTokens, uint64_t *pnProbes) {
+	unsigned int nTokens = 0;
+	const unsigned int maxLength = (1 << nSymBits) - 1 - 0x100 + 3;
+	const unsigned int maxDistance = (1 << nDstBits);
+	
+	//the match finder only sees as far back as a match can reach, so its positions are counted from there.
+	unsigned int window = min(start, maxDistance);
+	const unsigned char *base = buffer + start - window;
+	if (mfType == CX_MF_HASH_TABLE) {
+		return CxiAshTokenizeGreedy(ctx, base, window, end - (start - window), maxLength, maxDistance, tokenBuffer, pnTokens, pnProbes);
+	}
+	
+	CxiMatchFinder mf;
+	if (!CxiMatchFinderInit(ctx, &mf, base, end - (start - window), maxDistance, searchDepth, mfType)) {
+		return 0;
+	}
+	CxiMatchFinderSkip(&mf, 0, window, maxLength);
+	if (fastLevel != 0) {
+		CxiAshTokenizeLazy(&mf, window, maxLength, tokenBuffer, pnTokens);
+		*pnProbes = mf.nProbes;
+		return 1;
+	}
+	
+	//
+	unsigned int curpos = window;
+	while (curpos < mf.size) {
+		//search backwards
+		unsigned int length, distance;
+		length = CxiMatchFinderFind(&mf, curpos, maxLength, &distance);
+		
+		if (length >= 3) {
+			tokenBuffer[nTokens++] = CxiLzTokenReference(length, distance);
+			
+			//the first position was inserted by the search
+			CxiMatchFinderSkip(&mf, curpos + 1, length - 1, maxLength);
+			curpos += length;
+		} else  {
+			tokenBuffer[nTokens++] = CxiLzTokenLiteral(base[curpos]);
+			curpos++;
+		}
+	}
+	
+	*pnTokens = nTokens;
+	*pnProbes = mf.nProbes;
+	return 1;
+}
+
+//the returned tokens are held by the context, and stay valid until it is next used.
+static CxiLzToken *CxiAshTokenize(CxAshCompressContext *ctx, const unsigned char *buffer, unsigned int size, int nSymBits, int nDstBits, int mfType, int fastLevel, unsigned int searchDepth, unsigned int *pnTokens, uint64_t *pnProbes) {
+	//there can't be more tokens than bytes
+	CxiLzToken *tokenBuffer = (CxiLzToken *) CxiScratchReserve(ctx, CX_SCRATCH_TOKENS, size * sizeof(CxiLzToken), 0);
+	if (tokenBuffer == NULL) return NULL;
+	
+	if (!CxiAshTokenizeRange(ctx, buffer, 0, size, nSymBits, nDstBits, mfType, fastLevel, searchDepth, tokenBuffer, pnTokens, pnProbes)) {
+		return NULL;
+	}
+	return tokenBuffer;
+}
+
+//inputs are split into blocks of this size for tokenizing on several threads. the split doesn't depend on the
+//number of threads, so neither does the output.
+#define CX_LZ_TOKENIZE_BLOCK    0x40000
+#define CX_LZ_TOKENIZE_NBLOCKS  ((CX_ASH_MAX_SIZE + CX_LZ_TOKENIZE_BLOCK - 1) / CX_LZ_TOKENIZE_BLOCK)
+
+typedef struct CxiLzTokenizeJob_ {
+	CxAshCompressContext *ctx;
+	const unsigned char *buffer;
+	unsigned int size;
+	int nSymBits;
+	int nDstBits;
+	int mfType;
+	int fastLevel;
+	unsigned int searchDepth;
+	CxiLzToken *tokens;    //each block's tokens are written where the block starts
+	unsigned int nTokens[CX_LZ_TOKENIZE_NBLOCKS];
+	uint64_t nProbes[CX_LZ_TOKENIZE_NBLOCKS];
+	int failed;
+} CxiLzTokenizeJob;
+
+static void CxiAshTokenizeJob(void *param, unsigned int thread, unsigned int nThreads) {
+	CxiLzTokenizeJob *job = (CxiLzTokenizeJob *) param;
+	CxAshCompressContext *ctx = CxiThreadContext(job->ctx, thread);
+	
+	//blocks are handed out in turn. they take roughly the same time, give or take how well they compress.
+	for (unsigned int start = thread * CX_LZ_TOKENIZE_BLOCK; start < job->size; start += nThreads * CX_LZ_TOKENIZE_BLOCK) {
+		unsigned int end = min(start + CX_LZ_TOKENIZE_BLOCK, job->size);
+		unsigned int block = start / CX_LZ_TOKENIZE_BLOCK;
+		if (!CxiAshTokenizeRange(ctx, job->buffer, start, end, job->nSymBits, job->nDstBits, job->mfType, job->fastLevel, job->searchDepth, job->tokens + start, &job->nTokens[block], &job->nProbes[block])) {
+			job->failed = 1; //only ever set, so it doesn't matter which thread does
+			return;
+		}
+	}
+}
+
+//like CxiAshTokenize, but with the blocks split among the given threads. without any, they are tokenized one after
+//another on the calling thread.
+static CxiLzToken *CxiAshTokenizeParallel(CxAshCompressContext *ctx, CxiWorkers *workers, const unsigned char *buffer, unsigned int size, int nSymBits, int nDstBits, int mfType, int fastLevel, unsigned int searchDepth, unsigned int *pnTokens, uint64_t *pnProbes) {
+	CxiLzTokenizeJob job;
+	job.ctx = ctx;
+	job.buffer = buffer;
+	job.size = size;
+	job.nSymBits = nSymBits;
+	job.nDstBits = nDstBits;
+	job.mfType = mfType;
+	job.fastLevel = fastLevel;
+	job.searchDepth = searchDepth;
+	job.failed = 0;
+	job.tokens = (CxiLzToken *) CxiScratchReserve(ctx, CX_SCRATCH_TOKENS, size * sizeof(CxiLzToken), 0);
+	if (job.tokens == NULL) return NULL;
+	
+	CxiWorkersRun(workers, CxiAshTokenizeJob, &job);
+	if (job.failed) return NULL;
+	
+	//join the blocks up. each block has no more tokens than bytes, so its tokens only ever move forward.
+	unsigned int nTokens = 0;
+	uint64_t nProbes = 0;
+	for (unsigned int start = 0; start < size; start += CX_LZ_TOKENIZE_BLOCK) {
+		unsigned int nBlockTokens = job.nTokens[start / CX_LZ_TOKENIZE_BLOCK];
+		memmove(job.tokens + nTokens, job.tokens + start, nBlockTokens * sizeof(CxiLzToken));
+		nTokens += nBlockTokens;
+		nProbes += job.nProbes[start / CX_LZ_TOKENIZE_BLOCK];
+	}
+	
+	*pnTokens = nTokens;
+	*pnProbes = nProbes;
+	return job.tokens;
+}
+
+//builds both trees from the token frequencies, setting *pSymRoot and *pDstRoot to their roots. A nonzero
+//maxCodeLength makes the codes canonical and limits their length.
+static void CxiAshGenHuffman(const CxiLzToken *tokens, unsigned int nTokens, CxiHuffNode *symNodes, CxiHuffCode *symCodes, unsigned int nSymNodes, CxiHuffNode *dstNodes, CxiHuffCode *dstCodes, unsigned int nDstNodes, unsigned int maxCodeLength, uint32_t *work, CxiHuffNode **pSymRoot, CxiHuffNode **pDstRoot) {
+	CxiHuffmanInit(symNodes, nSymNodes);
+	CxiHuffmanInit(dstNodes, nDstNodes);
+	
+	//construct frequency distribution
+	for (unsigned int i = 0; i < nTokens; i++) {
+		CxiLzToken token = tokens[i];
+		symNodes[CxiLzTokenSymbol(token)].freq++;
+		if (CxiLzTokenIsReference(token)) dstNodes[CxiLzTokenDistSymbol(token)].freq++;
+	}
+	
+	//pre-tree construction: ensure at least two nodes are used
+	CxiAshEnsureTreeElements(symNodes, nSymNodes, 2);
+	CxiAshEnsureTreeElements(dstNodes, nDstNodes, 2);
+	
+	//construct trees
+	CxiHuffNode *symRoot = CxiHuffmanConstructTree(symNodes, nSymNodes, work);
+	CxiHuffNode *dstRoot = CxiHuffmanConstructTree(dstNodes, nDstNodes, work);
+	
+	//flatten trees for encoding and cost lookup
+	CxiHuffmanBuildCodes(symRoot, symCodes, nSymNodes);
+	CxiHuffmanBuildCodes(dstRoot, dstCodes, nDstNodes);
+	
+	if (maxCodeLength) {
+		symRoot = CxiHuffmanMakeCanonical(symNodes, symCodes, nSymNodes, maxCodeLength, work);
+		dstRoot = CxiHuffmanMakeCanonical(dstNodes, dstCodes, nDstNodes, maxCodeLength, work);
+	}
+	*pSymRoot = symRoot;
+	*pDstRoot = dstRoot;
+}
+
+//a match usable by the optimizing pass, and the number of bits its distance costs.
+typedef struct CxiLzMatch_ {
+	unsigned int length;
+	unsigned int distance;
+	unsigned int cost;
+} CxiLzMatch;
+
+//distance costs are code lengths, and a shorter match only stays on the front by being strictly cheaper than
+//every longer one, so the front never holds more matches than there are code lengths.
+#define CX_LZ_MAX_FRONT (CX_HUFF_MAX_CODE_LENGTH + 1)
+
+//cost in bits of each distance for the optimizing pass, indexed by distance. 0 marks a distance without a code.
+//minCostFrom holds the lowest cost of any distance from each one on, or CX_LZ_NO_COST if none have a code.
+#define CX_LZ_NO_COST 0xFF
+
+typedef struct CxiLzDistanceCosts_ {
+	const uint8_t *cost;
+	const uint8_t *minCostFrom;
+} CxiLzDistanceCosts;
+
+//matches gathered at one position by CxiAshGatherMatches. needed holds, for each cost, the length a match of that
+//cost must exceed to be of any use: the longest of the matches costing no more.
+typedef struct CxiLzMatchFront_ {
+	CxiLzMatch matches[CX_LZ_MAX_FRONT];
+	unsigned int nMatches;
+	unsigned int needed[CX_HUFF_MAX_CODE_LENGTH + 1];
+} CxiLzMatchFront;
+
+static void CxiAshAddMatch(CxiLzMatchFront *front, unsigned int length, unsigned int distance, unsigned int cost) {
+	CxiLzMatch *matches = front->matches;
+	unsigned int nMatches = front->nMatches;
+	
+	//the matches are longest first, so this goes after the longer ones, and takes the place of the shorter
+	//ones that cost as much or more, which come right after it.
+	unsigned int i = 0;
+	while (i < nMatches && matches[i].length > length) i++;
+	unsigned int j = i;
+	while (j < nMatches && matches[j].cost >= cost) j++;
+	memmove(matches + i + 1, matches + j, (nMatches - j) * sizeof(CxiLzMatch));
+	matches[i].length = length;
+	matches[i].distance = distance;
+	matches[i].cost = cost;
+	front->nMatches = nMatches = nMatches - (j - i - 1);
+	
+	//the cheapest matches come last.
+	unsigned int k = nMatches;
+	unsigned int longest = CX_MF_MIN_MATCH - 1;
+	for (unsigned int c = 1; c <= CX_HUFF_MAX_CODE_LENGTH; c++) {
+		while (k > 0 && matches[k - 1].cost <= c) longest = matches[--k].length;
+		front->needed[c] = longest;
+	}
+}
+
+//once a match runs the full length, at most this many more candidates are visited looking for a cheaper distance.
+//in a long run every earlier position of it matches the full length, so without a limit the whole chain would be
+//walked at each position of the run.
+#define CX_LZ_FULL_LENGTH_DEPTH 64
+
+//gathers the matches at pos worth considering: for any length, the match costing the least that is at least that
+//long. These are kept longest first, each strictly cheaper than the ones before it. The chains must link every
+//position of the buffer. returns the number of candidates visited.
+static unsigned int CxiAshGatherMatches(const CxiMatchFinder *mf, unsigned int pos, unsigned int maxLength, const CxiLzDistanceCosts *costs, CxiLzMatchFront *front) {
+	const unsigned char *buffer = mf->buffer;
+	const unsigned char *cur = buffer + pos;
+	front->nMatches = 0;
+	if (maxLength > mf->size - pos) maxLength = mf->size - pos;
+	if (maxLength < CX_MF_MIN_MATCH) return 0;
+	for (unsigned int c = 0; c <= CX_HUFF_MAX_CODE_LENGTH; c++) front->needed[c] = CX_MF_MIN_MATCH - 1;
+	
+	unsigned int depth = mf->maxDepth, nProbes = 0;
+	uint32_t next = mf->links[pos];
+	while (next != 0 && depth-- > 0) {
+		unsigned int distance = pos - (next - 1);
+		next = mf->links[next - 1];
+		if (distance > mf->maxDistance) break;
+		nProbes++;
+		
+		//distances without a code can't be used. To be of use, a match has to be longer than those costing no
+		//more, so first check the byte just past the longest of them.
+		unsigned int cost = costs->cost[distance];
+		if (cost == 0) continue;
+		unsigned int needed = front->needed[cost];
+		if (needed >= maxLength) {
+			//once a match runs the full length, only cheaper distances can improve on it. Distances only grow
+			//along the way, so stop when none of the remaining ones are cheaper.
+			if (front->matches[0].cost <= costs->minCostFrom[distance]) break;
+			continue;
+		}
+		const unsigned char *src = cur - distance;
+		if (src[needed] != cur[needed]) continue;
+		
+		unsigned int length = CxiCompareMemory(src, cur, maxLength);
+		if (length > needed) CxiAshAddMatch(front, length, distance, cost);
+		if (length == maxLength && depth > CX_LZ_FULL_LENGTH_DEPTH) depth = CX_LZ_FULL_LENGTH_DEPTH;
+	}
+	return nProbes;
+}
+
+//builds the hash chains the optimizing passes gather matches from. They don't depend on the codes, so they are
+//built once and kept for all passes.
+static int CxiAshBuildMatchChains(CxAshCompressContext *ctx, CxiMatchFinder *mf, const unsigned char *buffer, unsigned int size, int nSymBits, int nDstBits, unsigned int searchDepth) {
+	const unsigned int maxLength = (1 << nSymBits) - 1 - 0x100 + 3;
+	if (!CxiMatchFinderInit(ctx, mf, buffer, size, (1 << nDstBits), searchDepth, CX_MF_HASH_CHAIN)) return 0;
+	CxiMatchFinderSkip(mf, 0, size, maxLength);
+	return 1;
+}
+
+//the optimizing pass goes through the file in blocks of this many positions, gathering the matches of a whole
+//block, on as many threads as there are, before choosing the tokens from them.
+#define CX_LZ_GATHER_BLOCK 4096
+
+typedef struct CxiLzGatherJob_ {
+	const CxiMatchFinder *mf;
+	const CxiLzDistanceCosts *costs;
+	unsigned int maxLength;
+	unsigned int start;    //first position of the block
+	unsigned int end;
+	CxiLzMatch *matches;   //CX_LZ_MAX_FRONT per position, each thread packing its positions' matches together
+	uint32_t *first;       //per position, the index of its first match
+	uint8_t *nMatches;     //per position
+	uint64_t nProbes[CX_ASH_MAX_THREADS]; //candidates visited by each thread
+} CxiLzGatherJob;
+
+static void CxiAshGatherJob(void *param, unsigned int thread, unsigned int nThreads) {
+	CxiLzGatherJob *job = (CxiLzGatherJob *) param;
+	unsigned int nPositions = job->end - job->start;
+	unsigned int from = (unsigned int) ((uint64_t) nPositions * thread / nThreads);
+	unsigned int to = (unsigned int) ((uint64_t) nPositions * (thread + 1) / nThreads);
+	
+	//the matches of each thread's positions fit in the slots of those positions.
+	CxiLzMatchFront front;
+	uint32_t next = from * CX_LZ_MAX_FRONT;
+	uint64_t nProbes = 0;
+	for (unsigned int i = from; i < to; i++) {
+		nProbes += CxiAshGatherMatches(job->mf, job->start + i, job->maxLength, job->costs, &front);
+		memcpy(job->matches + next, front.matches, front.nMatches * sizeof(CxiLzMatch));
+		job->first[i] = next;
+		job->nMatches[i] = (uint8_t) front.nMatches;
+		next += front.nMatches;
+	}
+	job->nProbes[thread] = nProbes;
+}
+
+//like CxiAshTokenize, the returned tokens are held by the context. this reuses the same buffer, so the previous
+//tokenization is lost. the matches are gathered on the given threads, if any, and the candidates they visit are
+//added to *pnProbes.
+static CxiLzToken *CxiAshRetokenize(CxAshCompressContext *ctx, CxiWorkers *workers, const CxiMatchFinder *mf, const CxiHuffCode *symCodes, unsigned int nSymNodes, const CxiHuffCode *dstCodes, unsigned int nDstNodes, unsigned int *pnTokens, uint64_t *pnProbes) {
+	const unsigned char *buffer = mf->buffer;
+	const unsigned int size = mf->size;
+	const unsigned int maxLength = nSymNodes - 1 - 0x100 + 3;
+	
+	//allocate graph: the best token to take from each position, and the cost of the rest of the file when doing so.
+	//every node is written before it is read, scanning backwards. the tokens are written over the previous
+	//tokenization, which isn't needed anymore.
+	CxiLzToken *tokens = (CxiLzToken *) CxiScratchReserve(ctx, CX_SCRATCH_TOKENS, size * sizeof(CxiLzToken), 0);
+	uint32_t *weights = (uint32_t *) CxiScratchReserve(ctx, CX_SCRATCH_LZ_WEIGHTS, (size + 1) * sizeof(uint32_t), 0);
+	if (tokens == NULL || weights == NULL) return NULL;
+	
+	//the symbol lists are sized by the tree widths, so they only grow when the widths do.
+	CxiHuffSymbolInfo *lenInfo = (CxiHuffSymbolInfo *) CxiScratchReserve(ctx, CX_SCRATCH_LEN_INFO, (nSymNodes - 0x100) * sizeof(CxiHuffSymbolInfo), 0);
+	unsigned int *lens = (unsigned int *) CxiScratchReserve(ctx, CX_SCRATCH_LENS, (nSymNodes - 0x100) * sizeof(unsigned int), 0);
+	int *lenIndex = (int *) CxiScratchReserve(ctx, CX_SCRATCH_LEN_INDEX, (maxLength + 1) * sizeof(int), 0);
+	if (lenInfo == NULL || lens == NULL || lenIndex == NULL) return NULL;
+	
+	//list the allowed lengths, and index the longest allowed length up to each length.
+	int nLens = CxiHuffmanEnumerateSymbolInfo(symCodes, nSymNodes, 0x100, lenInfo);
+	for (int i = 0; i < nLens; i++) lens[i] = lenInfo[i].sym - 0x100 + 3;
+	for (unsigned int len = 0, i = 0; len <= maxLength; len++) {
+		while ((int) i < nLens && lens[i] <= len) i++;
+		lenIndex[len] = (int) i - 1;
+	}
+	
+	//tabulate the distance costs compactly, as they are looked up for every match candidate.
+	uint8_t *dstCost = (uint8_t *) CxiScratchReserve(ctx, CX_SCRATCH_DST_COSTS, 2 * (nDstNodes + 2), 0);
+	if (dstCost == NULL) return NULL;
+	uint8_t *minCostFrom = dstCost + nDstNodes + 2;
+	dstCost[0] = 0;
+	dstCost[nDstNodes + 1] = 0;
+	minCostFrom[nDstNodes + 1] = CX_LZ_NO_COST;
+	for (unsigned int distance = nDstNodes; distance > 0; distance--) {
+		unsigned int cost = dstCodes[distance - 1].length;
+		dstCost[distance] = (uint8_t) cost;
+		minCostFrom[distance] = (cost != 0 && cost < minCostFrom[distance + 1]) ? cost : minCostFrom[distance + 1];
+	}
+	minCostFrom[0] = minCostFrom[1];
+	
+	CxiLzDistanceCosts costs;
+	costs.cost = dstCost;
+	costs.minCostFrom = minCostFrom;
+	
+	//the matches of a block, and where each position's are.
+	CxiLzGatherJob job;
+	job.matches = (CxiLzMatch *) CxiScratchReserve(ctx, CX_SCRATCH_LZ_MATCHES, CX_LZ_GATHER_BLOCK * CX_LZ_MAX_FRONT * sizeof(CxiLzMatch), 0);
+	job.first = (uint32_t *) CxiScratchReserve(ctx, CX_SCRATCH_LZ_FIRST, CX_LZ_GATHER_BLOCK * (sizeof(uint32_t) + 1), 0);
+	if (job.matches == NULL || job.first == NULL) return NULL;
+	job.nMatches = (uint8_t *) (job.first + CX_LZ_GATHER_BLOCK);
+	job.mf = mf;
+	job.costs = &costs;
+	job.maxLength = nLens > 0 ? lens[nLens - 1] : 0;
+	
+	//scan backwards from the end of file. Past the end, nothing is left to encode.
+	weights[size] = 0;
+	for (unsigned int end = size; end > 0; end = job.start) {
+		job.start = end > CX_LZ_GATHER_BLOCK ? end - CX_LZ_GATHER_BLOCK : 0;
+		job.end = end;
+		CxiWorkersRun(workers, CxiAshGatherJob, &job);
+		unsigned int nThreads = workers != NULL ? CxiWorkersCount(workers) : 1;
+		for (unsigned int t = 0; t < nThreads; t++) *pnProbes += job.nProbes[t];
+		
+		unsigned int pos = end;
+		while (pos-- > job.start) {
+			//NOTE: all byte values that appear in the file will have a symbol associated since they must appear at least once.
+			//thus we do not need to check that any byte value exists.
+			CxiLzToken bestToken = CxiLzTokenLiteral(buffer[pos]);
+			unsigned int bestWeight = UINT_MAX;
+			
+			//try every allowed length, from the longest down, each with the cheapest distance that reaches it. ties go
+			//to the longer length.
+			const CxiLzMatch *matches = job.matches + job.first[pos - job.start];
+			unsigned int nMatches = job.nMatches[pos - job.start];
+			if (nMatches > 0) {
+				unsigned int f = 0;
+				for (int i = lenIndex[matches[0].length]; i >= 0; i--) {
+					unsigned int length = lens[i];
+					while (f + 1 < nMatches && matches[f + 1].length >= length) f++;
+					
+					unsigned int weight = lenInfo[i].depth + matches[f].cost + weights[pos + length];
+					if (weight < bestWeight) {
+						bestWeight = weight;
+						bestToken = CxiLzTokenReference(length, matches[f].distance);
+					}
+				}
+			}
+			
+			//byte literal
+			unsigned int literalWeight = symCodes[buffer[pos]].length + weights[pos + 1];
+			if (literalWeight < bestWeight) {
+				bestWeight = literalWeight;
+				bestToken = CxiLzTokenLiteral(buffer[pos]);
+			}
+			
+			//write node
+			tokens[pos] = bestToken;
+			weights[pos] = bestWeight;
+		}
+	}
+	
+	//follow the path through the graph from the start, packing its tokens to the front of the array. a token is
+	//never moved past the position it's read from, so this can be done in place.
+	unsigned int nTokens = 0;
+	unsigned int pos = 0;
+	while (pos < size) {
+		CxiLzToken token = tokens[pos];
+		tokens[nTokens++] = token;
+		pos += CxiLzTokenLength(token);
+	}
+	
+	*pnTokens = nTokens;
+	return tokens;
+}
+
+//microseconds since some fixed point, for timing the phases of compression.
+static uint64_t CxiGetMicroseconds(void) {
+	struct timespec ts;
+#ifdef CLOCK_MONOTONIC
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+	timespec_get(&ts, TIME_UTC);
+#endif
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+//sizes of the two streams the codes encode the tokens to, trees included, each padded to a whole word.
+static void CxiAshMeasureStreams(const CxiLzToken *tokens, unsigned int nTokens, const CxiHuffCode *symCodes, unsigned int nSymNodes, int nSymBits, const CxiHuffCode *dstCodes, unsigned int nDstNodes, int nDstBits, unsigned int *pSymStreamSize, unsigned int *pDstStreamSize) {
+	uint64_t nSymStreamBits = CxiHuffmanTreeBits(symCodes, nSymNodes, nSymBits);
+	uint64_t nDstStreamBits = CxiHuffmanTreeBits(dstCodes, nDstNodes, nDstBits);
+	for (unsigned int i = 0; i < nTokens; i++) {
+		CxiLzToken token = tokens[i];
+		
+		nSymStreamBits += symCodes[CxiLzTokenSymbol(token)].length;
+		if (CxiLzTokenIsReference(token)) nDstStreamBits += dstCodes[CxiLzTokenDistSymbol(token)].length;
+	}
+	*pSymStreamSize = CxiBitStreamWordAlignedSize(nSymStreamBits);
+	*pDstStreamSize = CxiBitStreamWordAlignedSize(nDstStreamBits);
+}
+
+void CxAshCompressParamsInit(CxAshCompressParams *params) {
+	params->symBits = 9;
+	params->distBits = 11;
+	params->nPasses = 0;
+	params->searchDepth = 0;
+	params->maxCodeLength = 0;
+	params->nThreads = 1;
+	params->timeLimit = 0;
+	params->fastLevel = 0;
+	params->splitBlocks = 0;
+}
+
+int CxAshCompress(CxAshCompressContext *ctx, const void *src, size_t srcSize, const CxAshCompressParams *params, const void **pDest, size_t *pDestSize) {
+	const unsigned char *buffer = (const unsigned char *) src;
+	int nSymBits = params->symBits, nDstBits = params->distBits;
+	unsigned int nPasses = params->nPasses, searchDepth = params->searchDepth, maxCodeLength = params->maxCodeLength;
+	unsigned int nThreads = params->nThreads ? params->nThreads : 1;
+	uint64_t startTime = CxiGetMicroseconds(), phaseStart = startTime, phaseEnd;
+	CxAshCompressInfo info;
+	memset(&info, 0, sizeof(info));
+	
+	if (nSymBits < CX_ASH_MIN_SYM_BITS || nSymBits > CX_ASH_MAX_BITS) return CX_ASH_ERR_INVALID_PARAM;
+	if (nDstBits < CX_ASH_MIN_DIST_BITS || nDstBits > CX_ASH_MAX_BITS) return CX_ASH_ERR_INVALID_PARAM;
+	if (nThreads > CX_ASH_MAX_THREADS) return CX_ASH_ERR_INVALID_PARAM;
+	if (params->fastLevel > CX_ASH_FAST_GREEDY) return CX_ASH_ERR_INVALID_PARAM;
+	if (srcSize > CX_ASH_MAX_SIZE) return CX_ASH_ERR_TOO_LARGE;
+	const unsigned int size = (unsigned int) srcSize;
+	
+	//start the threads to compress on, if there are to be any. they are kept by the context.
+	CxiWorkers *workers = NULL;
+	if (nThreads > 1) {
+		if (!CxiEnsureWorkers(ctx, nThreads)) return CX_ASH_ERR_NO_MEMORY;
+		workers = ctx->workers;
+	}
+	
+	//allocate tree structures
+	int nSymNodes = (1 << nSymBits);
+	int nDstNodes = (1 << nDstBits);
+	CxiHuffNode *symNodes = (CxiHuffNode *) CxiScratchReserve(ctx, CX_SCRATCH_SYM_NODES, nSymNodes * 2 * sizeof(CxiHuffNode), 1);
+	CxiHuffNode *dstNodes = (CxiHuffNode *) CxiScratchReserve(ctx, CX_SCRATCH_DST_NODES, nDstNodes * 2 * sizeof(CxiHuffNode), 1);
+	CxiHuffCode *symCodes = (CxiHuffCode *) CxiScratchReserve(ctx, CX_SCRATCH_SYM_CODES, nSymNodes * sizeof(CxiHuffCode), 1);
+	CxiHuffCode *dstCodes = (CxiHuffCode *) CxiScratchReserve(ctx, CX_SCRATCH_DST_CODES, nDstNodes * sizeof(CxiHuffCode), 1);
+	uint32_t *huffWork = (uint32_t *) CxiScratchReserve(ctx, CX_SCRATCH_HUFF_WORK, max(nSymNodes, nDstNodes) * sizeof(uint32_t), 0);
+	if (symNodes == NULL || dstNodes == NULL || symCodes == NULL || dstCodes == NULL || huffWork == NULL) {
+		return CX_ASH_ERR_NO_MEMORY;
+	}
+	
+	//tokenize. The binary tree match finder holds up better against long repetitive runs, so use it for the
+	//highest compression level. the fast levels trade the search for speed instead.
+	unsigned int nTokens = 0;
+	CxiHuffNode *symRoot, *dstRoot;
+	int fastLevel = (int) params->fastLevel;
+	int mfType = (nPasses >= 2) ? CX_MF_BINARY_TREE : CX_MF_HASH_CHAIN;
+	unsigned int tokenizeDepth = searchDepth;
+	if (fastLevel == CX_ASH_FAST_GREEDY) mfType = CX_MF_HASH_TABLE;
+	if (fastLevel == CX_ASH_FAST_LAZY) {
+		mfType = CX_MF_HASH_CHAIN;
+		if (tokenizeDepth == 0) tokenizeDepth = CX_LZ_LAZY_DEPTH;
+	}
+	CxiLzToken *tokens;
+	if (params->splitBlocks) tokens = CxiAshTokenizeParallel(ctx, workers, buffer, size, nSymBits, nDstBits, mfType, fastLevel, tokenizeDepth, &nTokens, &info.tokenizeProbes);
+	else tokens = CxiAshTokenize(ctx, buffer, size, nSymBits, nDstBits, mfType, fastLevel, tokenizeDepth, &nTokens, &info.tokenizeProbes);
+	if (tokens == NULL) return CX_ASH_ERR_NO_MEMORY;
+	phaseEnd = CxiGetMicroseconds();
+	info.tokenizeTime = phaseEnd - phaseStart;
+	phaseStart = phaseEnd;
+	
+	CxiAshGenHuffman(tokens, nTokens, symNodes, symCodes, nSymNodes, dstNodes, dstCodes, nDstNodes, maxCodeLength, huffWork, &symRoot, &dstRoot);
+	phaseEnd = CxiGetMicroseconds();
+	info.huffmanTime += phaseEnd - phaseStart;
+	phaseStart = phaseEnd;
+	
+	// ----------------------------------------------------------------------------------------------
+	//    Herein lies the really expensive operations (both memory and time).
+	// ----------------------------------------------------------------------------------------------
+	
+	//iterate on adjusting the frequency distribution and traversing the encoding space. The match finder used
+	//for tokenizing is done with, so its memory is taken over by the chains.
+	CxiMatchFinder chains;
+	if (nPasses > 0 && !CxiAshBuildMatchChains(ctx, &chains, buffer, size, nSymBits, nDstBits, searchDepth)) {
+		return CX_ASH_ERR_NO_MEMORY;
+	}
+	phaseEnd = CxiGetMicroseconds();
+	info.chainTime = phaseEnd - phaseStart;
+	phaseStart = phaseEnd;
+	
+	//the codes give the exact size of the output, so each pass can be measured against the best one so far. a pass
+	//that doesn't improve on it won't lead anywhere better, so stop there and go back to the best one.
+	unsigned int symStreamSize, dstStreamSize;
+	CxiAshMeasureStreams(tokens, nTokens, symCodes, nSymNodes, nSymBits, dstCodes, nDstNodes, nDstBits, &symStreamSize, &dstStreamSize);
+	uint64_t bestSize = (uint64_t) symStreamSize + dstStreamSize;
+	unsigned int bestPass = 0, nPassesRun = 0, nBestTokens = nTokens;
+	info.passSize[0] = (uint32_t) (0xC + bestSize);
+	CxiLzToken *bestTokens = NULL;
+	if (nPasses > 0) {
+		bestTokens = (CxiLzToken *) CxiScratchReserve(ctx, CX_SCRATCH_LZ_BEST, size * sizeof(CxiLzToken), 0);
+		if (bestTokens == NULL) return CX_ASH_ERR_NO_MEMORY;
+	}
+	
+	uint64_t passTime = 0;
+	while (nPassesRun < nPasses) {
+		//with a time limit, only start a pass it leaves time for. the first is only known to take some time.
+		if (params->timeLimit && phaseStart - startTime + passTime >= params->timeLimit * (uint64_t) 1000) break;
+		uint64_t passStart = phaseStart;
+		
+		//the tokens are about to be replaced, so hold on to them if they're the best yet.
+		if (bestPass == nPassesRun) {
+			memcpy(bestTokens, tokens, nTokens * sizeof(CxiLzToken));
+			nBestTokens = nTokens;
+		}
+		
+		//re-tokenize, replacing the previous tokenized sequence
+		tokens = CxiAshRetokenize(ctx, workers, &chains, symCodes, nSymNodes, dstCodes, nDstNodes, &nTokens, &info.retokenizeProbes);
+		if (tokens == NULL) return CX_ASH_ERR_NO_MEMORY;
+		phaseEnd = CxiGetMicroseconds();
+		info.retokenizeTime += phaseEnd - phaseStart;
+		phaseStart = phaseEnd;
+		
+		//regenerate huffman tree due to changes in frequency distribution
+		CxiAshGenHuffman(tokens, nTokens, symNodes, symCodes, nSymNodes, dstNodes, dstCodes, nDstNodes, maxCodeLength, huffWork, &symRoot, &dstRoot);
+		nPassesRun++;
+		phaseEnd = CxiGetMicroseconds();
+		info.huffmanTime += phaseEnd - phaseStart;
+		phaseStart = phaseEnd;
+		passTime = phaseEnd - passStart;
+		
+		CxiAshMeasureStreams(tokens, nTokens, symCodes, nSymNodes, nSymBits, dstCodes, nDstNodes, nDstBits, &symStreamSize, &dstStreamSize);
+		if (nPassesRun < CX_ASH_INFO_PASSES) info.passSize[nPassesRun] = (uint32_t) (0xC + symStreamSize + dstStreamSize);
+		if ((uint64_t) symStreamSize + dstStreamSize >= bestSize) break;
+		bestSize = (uint64_t) symStreamSize + dstStreamSize;
+		bestPass = nPassesRun;
+	}
+	
+	if (bestPass != nPassesRun) {
+		//the codes are rebuilt the same way as when the best tokens were first produced.
+		memcpy(tokens, bestTokens, nBestTokens * sizeof(CxiLzToken));
+		nTokens = nBestTokens;
+		CxiAshGenHuffman(tokens, nTokens, symNodes, symCodes, nSymNodes, dstNodes, dstCodes, nDstNodes, maxCodeLength, huffWork, &symRoot, &dstRoot);
+		CxiAshMeasureStreams(tokens, nTokens, symCodes, nSymNodes, nSymBits, dstCodes, nDstNodes, nDstBits, &symStreamSize, &dstStreamSize);
+		phaseEnd = CxiGetMicroseconds();
+		info.huffmanTime += phaseEnd - phaseStart;
+		phaseStart = phaseEnd;
+	}
+	// ----------------------------------------------------------------------------------------------
+	//    End of super intense operations
+	// ----------------------------------------------------------------------------------------------
+	
+	//the streams can be written straight to their place in the output.
+	unsigned char *out = (unsigned char *) CxiScratchReserve(ctx, CX_SCRATCH_OUTPUT, 0xC + symStreamSize + dstStreamSize, 0);
+	if (out == NULL) return CX_ASH_ERR_NO_MEMORY;
+	
+	{
+		//write header
+		uint32_t header[3];
+		header[0] = 0x30485341;    // 'ASH0'
+		header[1] = LittleToBig(size);
+		header[2] = LittleToBig(0xC + symStreamSize);
+		memcpy(out, header, sizeof(header));
+	}
+	
+	//init streams
+	BITSTREAM symStream, dstStream;
+	CxiBitStreamCreate(&symStream, out + 0xC, symStreamSize);
+	CxiBitStreamCreate(&dstStream, out + 0xC + symStreamSize, dstStreamSize);
+	
+	//first, write huffman trees.
+	CxiAshWriteTree(&symStream, symRoot, nSymBits);
+	CxiAshWriteTree(&dstStream, dstRoot, nDstBits);
+	
+	//write data stream
+	for (unsigned int i = 0; i < nTokens; i++) {
+		CxiLzToken token = tokens[i];
+		
+		CxiHuffmanWriteCode(&symStream, &symCodes[CxiLzTokenSymbol(token)]);
+		if (CxiLzTokenIsReference(token)) {
+			CxiHuffmanWriteCode(&dstStream, &dstCodes[CxiLzTokenDistSymbol(token)]);
+			info.nMatches++;
+			info.nMatchBytes += CxiLzTokenLength(token);
+		}
+	}
+	info.nLiterals = nTokens - info.nMatches;
+	
+	//pad out streams. Both must have come out at exactly the computed size.
+	unsigned int symWritten = 0, dstWritten = 0;
+	int ok = CxiBitStreamFinish(&symStream, &symWritten) & CxiBitStreamFinish(&dstStream, &dstWritten);
+	if (!ok || symWritten != symStreamSize || dstWritten != dstStreamSize) {
+		return CX_ASH_ERR_BUFFER_SIZE;
+	}
+	
+	info.outputTime = CxiGetMicroseconds() - phaseStart;
+	info.nPassesRun = nPassesRun;
+	info.bestPass = bestPass;
+	ctx->info = info;
+	*pDest = out;
+	*pDestSize = 0xC + symStreamSize + dstStreamSize;
+	return CX_ASH_OK;
+}
+
+
+
+// ----- width search
+
+//log2 of x in 16.16 fixed point, for x of at least 1. the fraction is found a bit at a time by squaring the
+//mantissa, each square doubling its logarithm.
+static uint64_t CxiLog2Fixed(uint32_t x) {
+	unsigned int e = 63 - CxiCountLeadingZeros64(x);
+	uint64_t m = (e <= 30) ? ((uint64_t) x << (30 - e)) : ((uint64_t) x >> (e - 30)); //1.30 fixed point
+	uint64_t result = (uint64_t) e << 16;
+	for (int i = 15; i >= 0; i--) {
+		m = (m * m) >> 30;
+		if (m >= (1u << 31)) {
+			m >>= 1;
+			result |= 1u << i;
+		}
+	}
+	return result;
+}
+
+//estimated bits of a stream holding the symbols counted in freq, tree included. the codes are taken to cost the
+//entropy of the symbols, which huffman codes come within a fraction of a bit per symbol of. the tree is exact.
+static uint64_t CxiAshEstimateStreamBits(const uint32_t *freq, unsigned int nSyms, int nBits) {
+	uint64_t nTotal = 0, sum = 0;
+	unsigned int nLeaves = 0;
+	for (unsigned int i = 0; i < nSyms; i++) {
+		if (freq[i] == 0) continue;
+		nTotal += freq[i];
+		sum += freq[i] * CxiLog2Fixed(freq[i]);
+		nLeaves++;
+	}
+	
+	//a tree always has at least two leaves, so a single symbol still costs a bit each time.
+	uint64_t nCodeBits = (nLeaves > 1) ? ((nTotal * CxiLog2Fixed((uint32_t) nTotal) - sum) >> 16) : nTotal;
+	if (nLeaves < 2) nLeaves = 2;
+	return nCodeBits + (nLeaves - 1) + nLeaves * (1 + nBits);
+}
+
+//candidates visited per position by the width search when no search depth is given. the search runs at nearly
+//every position across the widest window, which unlimited would take many times longer than compressing, and
+//deeper searches seldom change which widths come out best.
+#define CX_LZ_CHOOSE_DEPTH 128
+
+//a match of the width search too long for the narrowest symbol tree considered, kept to split up later.
+typedef struct CxiLzLongMatch_ {
+	uint32_t length;
+	uint32_t distSym;
+} CxiLzLongMatch;
+
+int CxAshChooseBits(CxAshCompressContext *ctx, const void *src, size_t srcSize, const CxAshCompressParams *params, int *pSymBits, int *pDistBits) {
+	const unsigned char *buffer = (const unsigned char *) src;
+	
+	if (*pSymBits != 0 && (*pSymBits < CX_ASH_MIN_SYM_BITS || *pSymBits > CX_ASH_MAX_BITS)) return CX_ASH_ERR_INVALID_PARAM;
+	if (*pDistBits != 0 && (*pDistBits < CX_ASH_MIN_DIST_BITS || *pDistBits > CX_ASH_MAX_BITS)) return CX_ASH_ERR_INVALID_PARAM;
+	if (srcSize > CX_ASH_MAX_SIZE) return CX_ASH_ERR_TOO_LARGE;
+	const unsigned int size = (unsigned int) srcSize;
+	
+	const int symLo = *pSymBits ? *pSymBits : CX_ASH_MIN_SYM_BITS, symHi = *pSymBits ? *pSymBits : CX_ASH_MAX_BITS;
+	const int dstLo = *pDistBits ? *pDistBits : CX_ASH_MIN_DIST_BITS, dstHi = *pDistBits ? *pDistBits : CX_ASH_MAX_BITS;
+	const unsigned int maxLengthHi = (1 << symHi) - 1 - 0x100 + 3, maxLengthLo = (1 << symLo) - 1 - 0x100 + 3;
+	const unsigned int nLengthsHi = (1 << symHi) - 0x100;
+	
+	//histograms for each distance width: literals, match lengths, and distances, which take 1 << w entries each.
+	//the matches too long for the narrowest symbol width get a list per distance width as well.
+	const unsigned int nWidths = CX_ASH_MAX_BITS + 1;
+	const unsigned int nLongMax = size / (maxLengthLo + 1) + 1;
+	size_t histSize = (nWidths * (256 + nLengthsHi) + (2u << dstHi) + (1 << symHi) + (1 << dstHi)) * sizeof(uint32_t);
+	uint32_t *hist = (uint32_t *) CxiScratchReserve(ctx, CX_SCRATCH_WIDTH_HIST, histSize, 1);
+	CxiLzLongMatch *longMatches = NULL;
+	if (symLo < symHi) longMatches = (CxiLzLongMatch *) CxiScratchReserve(ctx, CX_SCRATCH_LZ_MATCHES, nWidths * nLongMax * sizeof(CxiLzLongMatch), 0);
+	if (hist == NULL || (symLo < symHi && longMatches == NULL)) return CX_ASH_ERR_NO_MEMORY;
+	uint32_t *literalFreq = hist;                             //256 per width
+	uint32_t *lengthFreq = literalFreq + nWidths * 256;       //nLengthsHi per width
+	uint32_t *dstFreq = lengthFreq + nWidths * nLengthsHi;    //1 << w per width, from 1 << w
+	uint32_t *symFreq = dstFreq + (2u << dstHi);
+	uint32_t *dstFreqSplit = symFreq + (1 << symHi);
+	unsigned int nLong[CX_ASH_MAX_BITS + 1] = { 0 };
+	
+	//one sweep of the match finder tokenizes the input greedily at every distance width side by side, each from
+	//its own position. the chains are searched wherever one of them has got to. dstHi is the widest window, and
+	//the narrower ones come out of the same chain walk, so each width makes the choices CxiAshTokenize would.
+	CxiMatchFinder mf;
+	unsigned int searchDepth = params->searchDepth ? params->searchDepth : CX_LZ_CHOOSE_DEPTH;
+	if (!CxiMatchFinderInit(ctx, &mf, buffer, size, 1 << dstHi, searchDepth, CX_MF_HASH_CHAIN)) return CX_ASH_ERR_NO_MEMORY;
+	unsigned int next[CX_ASH_MAX_BITS + 1], lengths[CX_ASH_MAX_BITS + 1], distances[CX_ASH_MAX_BITS + 1];
+	for (int w = dstLo; w <= dstHi; w++) next[w] = 0;
+	for (unsigned int pos = 0; pos < size; pos++) {
+		unsigned int maxLength = min(maxLengthHi, size - pos);
+		int search = 0;
+		for (int w = dstLo; w <= dstHi; w++) search |= next[w] == pos;
+		
+		if (maxLength < CX_MF_MIN_MATCH) {
+			memset(lengths, 0, sizeof(lengths));
+		} else if (search) {
+			CxiMatchFinderHashChainWindows(&mf, pos, maxLength, dstHi, lengths, distances);
+		} else {
+			CxiMatchFinderHashChain(&mf, pos, maxLength, 0, &distances[0]);
+			continue;
+		}
+		
+		for (int w = dstLo; w <= dstHi; w++) {
+			if (next[w] != pos) continue;
+			if (lengths[w] < CX_MF_MIN_MATCH) {
+				literalFreq[256 * w + buffer[pos]]++;
+				next[w]++;
+				continue;
+			}
+			lengthFreq[nLengthsHi * w + lengths[w] - 3]++;
+			dstFreq[(1 << w) + distances[w] - 1]++;
+			if (lengths[w] > maxLengthLo) {
+				CxiLzLongMatch *match = &longMatches[nLongMax * w + nLong[w]++];
+				match->length = lengths[w];
+				match->distSym = distances[w] - 1;
+			}
+			next[w] += lengths[w];
+		}
+	}
+	
+	uint64_t bestSize = UINT64_MAX;
+	for (int nSymBits = symLo; nSymBits <= symHi; nSymBits++) {
+		const unsigned int maxLength = (1 << nSymBits) - 1 - 0x100 + 3;
+		for (int nDstBits = dstLo; nDstBits <= dstHi; nDstBits++) {
+			//matches too long for this width are split the way they could be written, keeping every piece at
+			//least 3 bytes long. each piece takes another distance.
+			const uint32_t *widthLengths = lengthFreq + nLengthsHi * nDstBits;
+			memcpy(symFreq, literalFreq + 256 * nDstBits, 256 * sizeof(uint32_t));
+			memset(symFreq + 256, 0, ((1 << nSymBits) - 0x100) * sizeof(uint32_t));
+			for (unsigned int length = 3; length <= maxLengthHi; length++) {
+				uint32_t count = widthLengths[length - 3];
+				if (count == 0) continue;
+				if (length <= maxLength) {
+					symFreq[0x100 + length - 3] += count;
+					continue;
+				}
+				
+				unsigned int nWhole = length / maxLength, rest = length % maxLength;
+				if (rest == 0 || rest >= 3) {
+					symFreq[0x100 + maxLength - 3] += nWhole * count;
+					if (rest) symFreq[0x100 + rest - 3] += count;
+				} else {
+					//too little is left over for a match, so the last whole piece gives up some of its bytes.
+					symFreq[0x100 + maxLength - 3] += (nWhole - 1) * count;
+					symFreq[0x100 + maxLength + rest - 3 - 3] += count;
+					symFreq[0x100] += count;
+				}
+			}
+			
+			const uint32_t *widthDists = dstFreq + (1 << nDstBits);
+			if (nSymBits < symHi) {
+				memcpy(dstFreqSplit, widthDists, (1 << nDstBits) * sizeof(uint32_t));
+				for (unsigned int i = 0; i < nLong[nDstBits]; i++) {
+					const CxiLzLongMatch *match = &longMatches[nLongMax * nDstBits + i];
+					if (match->length > maxLength) dstFreqSplit[match->distSym] += (match->length - 1) / maxLength;
+				}
+				widthDists = dstFreqSplit;
+			}
+			
+			uint64_t symStreamBits = CxiAshEstimateStreamBits(symFreq, 1 << nSymBits, nSymBits);
+			uint64_t dstStreamBits = CxiAshEstimateStreamBits(widthDists, 1 << nDstBits, nDstBits);
+			uint64_t estSize = (uint64_t) CxiBitStreamWordAlignedSize(symStreamBits) + CxiBitStreamWordAlignedSize(dstStreamBits);
+			if (estSize < bestSize) {
+				bestSize = estSize;
+				*pSymBits = nSymBits;
+				*pDistBits = nDstBits;
+			}
+		}
+	}
+	return CX_ASH_OK;
+}